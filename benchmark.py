@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""
+Micro-benchmarks of the majka module.
+
+Usage: ./benchmark.py path/to/database words.txt [benchmark ...]
+
+The word list holds one word form per line. Without benchmark names all
+benchmarks are run.
+"""
+
+import collections
+import subprocess
+import sys
+import timeit
+
+import majka
+
+
+def measure(stmt, number):
+    """Best per-call time in microseconds out of five runs."""
+    return min(timeit.repeat(stmt, number=number, repeat=5)) / number * 1e6
+
+
+def bench_find(morph, words):
+    """Time of single-word find calls, batch lookups for comparison."""
+    n = len(words)
+    results = {}
+    for name, tags in (('find', True), ('find, tags=False', False)):
+        morph.tags = tags
+        results[name] = measure(lambda: [morph.find(w) for w in words], 20) / n
+    morph.tags = True
+    if hasattr(morph, 'find_many'):
+        results['find_many'] = measure(lambda: morph.find_many(words), 20) / n
+    if hasattr(morph, 'imap'):
+        results['imap'] = measure(lambda: list(morph.imap(iter(words))), 20) / n
+    if hasattr(morph, 'best'):
+        morph.best = 1
+        results['find_many, best=1'] = measure(lambda: morph.find_many(words), 20) / n
+        morph.best = 0
+    encoded = [w.encode('utf-8') for w in words]
+    try:
+        morph.find(encoded[0])
+        results['find, bytes'] = measure(lambda: [morph.find(w) for w in encoded], 20) / n
+    except TypeError:
+        pass
+    return results
+
+
+def bench_count(morph, words):
+    """Lemma frequencies by count against a Counter over find_many."""
+    n = len(words)
+    morph.tags = False
+    results = {
+        'Counter(find_many)': measure(lambda: collections.Counter(
+            r['lemma'] for found in morph.find_many(words) for r in found), 5) / n,
+        'count': measure(lambda: morph.count(words, parallel=False), 5) / n,
+        'count, parallel': measure(lambda: morph.count(words), 5) / n,
+        "count, by=('lemma', 'case')":
+            measure(lambda: morph.count(words, by=('lemma', 'case')), 5) / n,
+    }
+    morph.tags = True
+    return results
+
+
+def bench_tags(morph, words):
+    """Decoding of tags into dicts: find_many with and without it."""
+    n = len(words)
+    results = {}
+    for name, tags, compact in (('tags=False', False, False),
+                                ('compact_tag', False, True),
+                                ('tags', True, False)):
+        morph.tags, morph.compact_tag = tags, compact
+        results['find_many, ' + name] = measure(lambda: morph.find_many(words), 10) / n
+    morph.tags, morph.compact_tag = True, False
+    results['decoding'] = results['find_many, tags'] - results['find_many, tags=False']
+    return results
+
+
+WARMUP_CHILD = """
+import sys, time, majka
+words = sys.stdin.read().split()
+morph = majka.Majka(sys.argv[1], int(sys.argv[2]))
+for run in range(2):
+    start = time.perf_counter()
+    for w in words:
+        morph.find(w)
+    print((time.perf_counter() - start) / len(words) * 1e6)
+print(morph.resident)
+"""
+
+
+def bench_warmup(morph, words, first=1000):
+    """Latency of the first lookups after load, in a fresh process per option.
+
+    The page cache is not dropped, "cold" means not yet faulted into the
+    process. A second pass over the words is the warm reference.
+    """
+    words = '\n'.join(words[:first])
+    results = {}
+    options = (('default', 0),
+               ('prefault', majka.RESIDENT_PREFAULT),
+               ('prefault+huge pages',
+                majka.RESIDENT_PREFAULT | majka.RESIDENT_HUGE_PAGES),
+               ('prefault+lock', majka.RESIDENT_PREFAULT | majka.RESIDENT_LOCK))
+    for name, resident in options:
+        out = subprocess.run([sys.executable, '-c', WARMUP_CHILD, morph.path,
+                              str(resident)], input=words, check=True,
+                             stdout=subprocess.PIPE, universal_newlines=True)
+        cold, warm, done = out.stdout.split()
+        if int(done) != resident:
+            name += ' (only %d took effect)' % int(done)
+        results[name + ', first'] = float(cold)
+        results[name + ', again'] = float(warm)
+    return results
+
+
+def bench_oov(morph, words):
+    """Lookups of unknown words with and without OOV_FILTER.
+
+    Unknown words are made of the known ones: reversed, with digits appended
+    and as parts of URLs. The first lookup with the flag builds the filter.
+    """
+    unknown = [w[::-1] + 'q' for w in words] + [w + '42' for w in words] + \
+        ['https://%s.example/%s' % (w, w) for w in words]
+    unknown = [w for w, r in zip(unknown, morph.find_many(unknown)) if not r]
+    n = len(unknown)
+    morph.tags = False
+    results = {}
+    for flags in (0, majka.ADD_DIACRITICS | majka.IGNORE_CASE):
+        morph.flags = flags
+        results['find_many, flags=%d' % flags] = measure(
+            lambda: morph.find_many(unknown), 5) / n
+        morph.flags = flags | majka.OOV_FILTER
+        results['find_many, flags=%d, OOV_FILTER' % flags] = measure(
+            lambda: morph.find_many(unknown), 5) / n
+    morph.flags = 0
+    morph.tags = True
+    return results
+
+
+def edits(word, alphabet):
+    """All strings one deletion, substitution or insertion away."""
+    splits = [(word[:i], word[i:]) for i in range(len(word) + 1)]
+    return set([a + b[1:] for a, b in splits if b] +
+               [a + c + b[1:] for a, b in splits if b for c in alphabet] +
+               [a + c + b for a, b in splits for c in alphabet])
+
+
+def bench_fuzzy(morph, words, first=200):
+    """find_fuzzy against looking up every edit of the word (brute force).
+
+    The brute force over two edits is run on a tenth of the words only.
+    """
+    words = words[:first]
+    alphabet = sorted(set(''.join(words)))
+    few = words[:max(1, len(words) // 10)]
+
+    def brute(word, distance):
+        candidates = {word}
+        for _ in range(distance):
+            candidates |= set(e for c in candidates for e in edits(c, alphabet))
+        return [r for r in morph.find_many(sorted(candidates)) if r]
+
+    results = {}
+    for distance, sample in ((1, words), (2, few)):
+        n = len(sample)
+        results['find_fuzzy, distance %d' % distance] = measure(
+            lambda: [morph.find_fuzzy(w, distance) for w in sample], 1) / n
+        results['brute force, distance %d' % distance] = measure(
+            lambda: [brute(w, distance) for w in sample], 1) / n
+    return results
+
+
+def bench_decompose(morph, words):
+    """Splits of compounds by decompose, single find calls for comparison.
+
+    Only dictionaries with compounds ('!' and '^' keys) have any splits.
+    """
+    n = len(words)
+    return {
+        'find': measure(lambda: [morph.find(w) for w in words], 5) / n,
+        'decompose': measure(lambda: [morph.decompose(w) for w in words], 5) / n,
+    }
+
+
+BENCHMARKS = {
+    'count': bench_count,
+    'decompose': bench_decompose,
+    'find': bench_find,
+    'fuzzy': bench_fuzzy,
+    'oov': bench_oov,
+    'tags': bench_tags,
+    'warmup': bench_warmup,
+}
+
+
+def main(argv):
+    if len(argv) < 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+    morph = majka.Majka(argv[1])
+    with open(argv[2], encoding='utf-8') as f:
+        words = [line.strip() for line in f if line.strip()]
+    for name in argv[3:] or sorted(BENCHMARKS):
+        print(name)
+        for label, value in BENCHMARKS[name](morph, words).items():
+            print('  %-40s %8.3f us/word' % (label, value))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -5,7 +5,57 @@
 #include	<string.h>
 #include	<stdlib.h>
 #include	<new>
+#include	<atomic>
 #include	"majka.h"
+#ifdef MAJKA_MMAP
+#include	<fcntl.h>
+#include	<sys/mman.h>
+#include	<sys/stat.h>
+#include	<unistd.h>
+#endif
+
+static atomic<uint64_t>	serials(0);
+
+// OOV_FILTER: bits set per key in its block of the filter, bits of the filter per key
+const int		oov_probes = 7;
+const size_t		oov_bits_per_key = 12;
+
+// Recently missed words of each thread, by the automaton and the flags they were sought with
+struct oov_miss {
+  uint64_t		owner;
+  char			flags;
+  unsigned char		length;
+  unsigned char		word[max_word_length];
+};
+const int		oov_misses_count = 256;
+static thread_local oov_miss	oov_misses[oov_misses_count];
+
+// Results of recently found first parts of compounds of each thread, by the automaton;
+// frequent first parts (velko-, mezi-) are not completed and decoded again
+struct cached_head {
+  uint64_t		owner;
+  unsigned char		length;
+  unsigned short	size;		// of the word and the results, as word_match has them
+  int			count;
+  unsigned char		head[max_word_length];
+  char			results[512];
+};
+const int		cached_heads_count = 32;
+static thread_local cached_head	cached_heads[cached_heads_count];
+
+// FNV-1a of the word folded by the table, finished by the mixer of MurmurHash3
+static inline uint64_t oov_hash(const unsigned char * const word, const size_t len, const unsigned char * const table) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) h = (h ^ table[word[i]]) * 1099511628211ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+#ifdef UTF
+const unsigned char	dropped = 255;	// NORMALIZE: in utf2 and punct, characters left out
+#endif
 
 struct signature { // dictionary file signature
   char			sig[4];		// automaton identifier (magic number)
@@ -21,7 +71,7 @@ struct signature { // dictionary file signature
   unsigned int		max_results_size;
 };
 
-int fsa::read_fsa(const char * const dict_file_name) {
+int fsa::read_fsa(const char * const dict_file_name, ostream &log) {
   const int	version = 5;
   streampos	file_ptr;
   long int	fsa_size;
@@ -30,33 +80,33 @@ int fsa::read_fsa(const char * const dict_file_name) {
   // open dictionary file
   ifstream dict_file(dict_file_name, ios::in | ios::ate | ios::binary);
   if (dict_file.fail()) {
-    cerr << "Cannot open dictionary file " << dict_file_name << endl;
+    log << "Cannot open dictionary file " << dict_file_name << endl;
     return 2;
   }
   fsa_size = (long int) dict_file.tellg() - sizeof(sig_arc);
   if (!dict_file.seekg(0L)) {
-    cerr << "Seek on dictionary file " << dict_file_name << " failed" << endl;
+    log << "Seek on dictionary file " << dict_file_name << " failed" << endl;
     return 3;
   }
 
   // read and verify signature
   if (!(dict_file.read((char *)&sig_arc, sizeof(sig_arc)))) {
-    cerr << "Cannot read a signature of dictionary file " << dict_file_name << endl;
+    log << "Cannot read a signature of dictionary file " << dict_file_name << endl;
     return 4;
   }
   if (strncmp(sig_arc.sig, "\\fsa", (size_t)4)) {
-    cerr << "Invalid dictionary file (bad magic number): " << dict_file_name << endl;
+    log << "Invalid dictionary file (bad magic number): " << dict_file_name << endl;
     return 5;
   }
 #define MYVERSION 1
   if (sig_arc.version_major != MYVERSION) {
-    cerr << "Invalid majka dictionary version (" << sig_arc.version_major << " instead of " << MYVERSION << ") "
+    log << "Invalid majka dictionary version (" << sig_arc.version_major << " instead of " << MYVERSION << ") "
          << "of dictionary file " << dict_file_name << endl;
     return 6;
   }
   version_major = sig_arc.version_major;
   if (sig_arc.ver != version) {
-    cerr << "Invalid fsa dictionary version (" << int(sig_arc.ver) << " instead of 5) "
+    log << "Invalid fsa dictionary version (" << int(sig_arc.ver) << " instead of 5) "
          << "of dictionary file " << dict_file_name << endl;
     return 61;
   }
@@ -65,28 +115,177 @@ int fsa::read_fsa(const char * const dict_file_name) {
   _max_results_size	= sig_arc.max_results_size;
   max_results_size	= _max_results_size + 2 * (max_word_length + 2);
   type			= sig_arc.type;
+  tagged		= (type & 127) == 1 || (type & 127) == 4;
+  if (! bind_decoder()) {
+    log << "Invalid dictionary file (cannot interpret file of type " << (short int) type << "): " << dict_file_name << endl;
+    return 8;
+  }
   version_minor		= sig_arc.version_minor;
   goto_length		= sig_arc.goto_length & 0x0f;
+  dict_size		= fsa_size;
+
+#ifdef MAJKA_MMAP
+  // the automaton is paged in on demand and shared with forked processes
+  if ((dict = map_fsa(dict_file_name, sizeof(sig_arc) + fsa_size))) {
+    dict += sizeof(sig_arc);
+    return 0;
+  }
+#endif
 
   // allocate memory and read the automaton, + sizeof(size_t) due to bytes2int :-)
   dict = new unsigned char[fsa_size + sizeof(size_t)];
   if (!(dict_file.read((char *) dict, fsa_size))) {
-    cerr << "Cannot read dictionary file " << dict_file_name << endl;
+    log << "Cannot read dictionary file " << dict_file_name << endl;
     delete [] dict;
     return 7;
   }
   return 0;
 }
 
+#ifdef MAJKA_MMAP
+arc_pointer fsa::map_fsa(const char * const dict_file_name, const size_t file_size) {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  // whole pages, + sizeof(size_t) due to bytes2int again
+  const size_t len = (file_size + sizeof(size_t) + page - 1) / page * page;
+  void * base, * file;
+  int fd;
+
+  if ((fd = open(dict_file_name, O_RDONLY)) < 0) return NULL;
+  // a file being rewritten in place would be mapped half-written, it is read then
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size != file_size) {
+    close(fd);
+    return NULL;
+  }
+  // anonymous zero pages keep the padding past the end of file readable
+  base = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  file = mmap(base, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    munmap(base, len);
+    return NULL;
+  }
+  mapped_len = len;
+  return (arc_pointer) base;
+}
+#endif
+
+#ifdef MAJKA_MMAP
+// Anonymous mapping of len bytes aligned to align, MAP_FAILED if there is none
+static void * map_aligned(const size_t len, const size_t align, const int flags) {
+  char * const raw = (char *) mmap(NULL, len + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  if (raw == MAP_FAILED) return MAP_FAILED;
+  char * const base = raw + (align - (uintptr_t) raw % align) % align;
+  if (base > raw) munmap(raw, base - raw);
+  munmap(base + len, raw + align - base);
+  return base;
+}
+#endif
+
+// Returns the options which took effect, the others are silently skipped
+int fsa::make_resident(const int options) {
+  int done = 0;
+#ifdef MAJKA_MMAP
+  const size_t huge_page = 2 << 20, page = sysconf(_SC_PAGESIZE);
+
+  if (options & (RESIDENT_HUGETLB | RESIDENT_HUGE_PAGES)) {
+    // the automaton is copied to keep the layout of map_fsa, huge pages can't back a file mapping
+    const size_t len = (sizeof(signature) + dict_size + sizeof(size_t) + huge_page - 1) / huge_page * huge_page;
+    void * base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (options & RESIDENT_HUGETLB) {
+      base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (base != MAP_FAILED) done |= RESIDENT_HUGETLB;
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (base == MAP_FAILED && (options & RESIDENT_HUGE_PAGES)
+        && (base = map_aligned(len, huge_page, 0)) != MAP_FAILED) {
+      if (madvise(base, len, MADV_HUGEPAGE)) {
+        munmap(base, len);
+        base = MAP_FAILED;
+      } else done |= RESIDENT_HUGE_PAGES;
+    }
+#endif
+    if (base != MAP_FAILED) {
+      memcpy((unsigned char *) base + sizeof(signature), dict, dict_size);
+      mprotect(base, len, PROT_READ);
+      free_fsa();
+      dict = (arc_pointer) base + sizeof(signature);
+      mapped_len = len;
+    }
+  }
+
+  // page aligned span of the automaton
+  unsigned char * const from = (unsigned char *) ((uintptr_t) dict / page * page);
+  const size_t span = dict + dict_size - from;
+  if (options & RESIDENT_PREFAULT) {
+    madvise(from, span, MADV_WILLNEED);	// one big read ahead instead of a fault per page
+    volatile unsigned char sum = 0;
+    for (size_t i = 0; i < span; i += page) sum += from[i];
+    done |= RESIDENT_PREFAULT;
+  }
+  if ((options & RESIDENT_LOCK) && ! mlock(from, span)) done |= RESIDENT_LOCK;
+#else
+  done = options & RESIDENT_PREFAULT;	// the automaton is read into memory anyway
+#endif
+  return done;
+}
+
+void fsa::free_fsa(void) {
+#ifdef MAJKA_MMAP
+  if (mapped_len) {
+    munmap((void *) (dict - sizeof(signature)), mapped_len);
+    return;
+  }
+#endif
+  delete [] dict;
+}
+
+fsa::~fsa(void) {
+  if (state) return;
+  free_fsa();
+#ifdef SWIG
+  delete [] results_buf;
+#endif
+}
+
 #define forallnodes(node, i) for (int i = 1; i; i = !(node[goto_offset] & 2), node += goto_offset + goto_length)
+// the same with go_to fields of the width the kernel is specialized on
+#define forallnodes_g(node, i) for (int i = 1; i; i = !(node[goto_offset] & 2), node += goto_offset + goto_width<G>())
 
-fsa::fsa(const char * const dict_name) {
-  if ((state = read_fsa(dict_name))) return;
+template <int G>
+void fsa::bind_kernels(void) {
+  find_kernel = &fsa::find_with<G>;
+  fuzzy_kernel = &fsa::fuzzy_with<G>;
+  complete_kernel = &fsa::complete_with<G>;
+  decompose_kernel = &fsa::decompose_with<G>;
+}
+
+fsa::fsa(const char * const dict_name, const int residency, const bool quiet) {
+  ostream nowhere(NULL);	// discards all output
+  serial = ++serials;
+  bind_kernels<0>();
+  mapped_len = 0;
+  resident = 0;
+  if ((state = read_fsa(dict_name, quiet ? nowhere : cerr))) return;
+  if (residency) resident = make_resident(residency);
 
 #ifdef SWIG
   results_buf = new char[max_results_size];
 
 #endif
+  switch (goto_length) {
+    case 1: bind_kernels<1>(); break;
+    case 2: bind_kernels<2>(); break;
+    case 3: bind_kernels<3>(); break;
+    case 4: bind_kernels<4>(); break;
+    default: bind_kernels<0>();
+  }
   start = first_node();
   start1 = start2 = NULL;
 
@@ -106,6 +305,19 @@ fsa::fsa(const char * const dict_name) {
       }
     }
 
+  init_tables();
+}
+
+// Conversion tables only, for fsa_builder
+fsa::fsa(void) {
+  serial = ++serials;
+  state = -1;
+  resident = 0;
+  mapped_len = 0;
+  init_tables();
+}
+
+void fsa::init_tables(void) {
   for (int i = 0; i < 256; i++) table[i] = i;
   table[161] = 'A'; table[177] = 'a'; // Ąą
   table[163] = 'L'; table[179] = 'l'; // Łł
@@ -238,6 +450,49 @@ fsa::fsa(const char * const dict_name) {
   table3[0][156] = 220; table3[0][188] = 252; // Üü
   table3[0][157] = 221; table3[0][189] = 253; // Ýý
   table3[2][162] = 222; table3[2][163] = 254; // Ţţ
+
+  // NORMALIZE
+  memset(utf2, 0, sizeof(utf2));
+  for (int i = 0; i < 3; i++) for (int j = 128; j < 192; j++) if (table3[i][j] != 32) utf2[i + 1][j - 128] = table3[i][j];
+  utf2[0][0x20] = ' ';			// no-break space
+  utf2[0][0x2d] = dropped;		// soft hyphen
+  utf2[0][0x34] = '\'';			// acute accent
+  utf2[0][0x2b] = utf2[0][0x3b] = '"';	// guillemets
+  utf2[8][0x39] = utf2[8][0x3c] = '\'';	// modifier prime and apostrophe
+  // Cyrillic letters looking like Latin ones
+  const char * const homoglyphs = "АAВBЕEЅSІIЈJКKМMНHОOРPСCТTХXаaеeоoрpсcуyхxѕsіiјj";
+  for (const unsigned char * i = (const unsigned char *) homoglyphs; *i; i += 3) utf2[i[0] - 0xc2][i[1] - 0x80] = i[2];
+
+  memset(punct, 0, sizeof(punct));
+  for (int i = 0x00; i <= 0x0a; i++) punct[i] = ' ';	// spaces of various widths
+  punct[0x2f] = ' ';
+  punct[0x0b] = punct[0x0c] = punct[0x0d] = dropped;	// zero width characters
+  for (int i = 0x10; i <= 0x15; i++) punct[i] = '-';	// hyphens and dashes
+  punct[0x18] = punct[0x19] = punct[0x1b] = punct[0x32] = '\'';
+  punct[0x1c] = punct[0x1d] = punct[0x1e] = punct[0x1f] = punct[0x33] = '"';
+  punct[0x24] = '.';
+
+  static const struct { int mark; const char * letters; } composed[] = {
+    {0x301, "ÁáĆćÉéÍíĹĺŃńÓóŔŕŚśÚúÝýŹź"},	// acute
+    {0x302, "ÂâÎîÔô"},			// circumflex
+    {0x306, "Ăă"},				// breve
+    {0x307, "Żż"},				// dot above
+    {0x308, "ÄäËëÖöÜü"},			// diaeresis
+    {0x30a, "Ůů"},				// ring above
+    {0x30b, "ŐőŰű"},			// double acute
+    {0x30c, "ČčĎďĚěĽľŇňŘřŠšŤťŽž"},	// caron
+    {0x327, "ÇçŞşŢţ"},			// cedilla
+    {0x328, "ĄąĘę"},			// ogonek
+  };
+  memset(marks, 0, sizeof(marks));
+  memset(compose, 0, sizeof(compose));
+  for (int m = 0; m < 10; m++) {
+    marks[composed[m].mark - 0x300] = m + 1;
+    for (const unsigned char * i = (const unsigned char *) composed[m].letters; *i; i += 2) {
+      const unsigned char letter = table3[*i - 195][i[1]];
+      compose[m + 1][table[letter]] = letter;
+    }
+  }
 #endif
 }
 
@@ -246,10 +501,14 @@ fsa::fsa(const char * const dict_name) {
 #define result res.result
 #define results_count res.results_count
 #define input_len res.input_len
-int fsa::find(const char * const sought, char * const results_buf, const char flags) {
+template <int G>
+int fsa::find_with(const char * const sought, char * const results_buf, const char flags, const tag_filter * const filter) {
   unsigned char * copy = (unsigned char *) results_buf + _max_results_size;
   thread_specific res;
 
+  res.filter = tagged && filter && ! filter->empty() ? filter : NULL;
+  res.result_end = NULL;
+
   candidate = (unsigned char *) results_buf + _max_results_size + max_word_length + 2;
   result = (unsigned char *) results_buf;
   results_count = 0;
@@ -257,6 +516,16 @@ int fsa::find(const char * const sought, char * const results_buf, const char fl
   unsigned char * j = copy;
   const unsigned char * tmp = (const unsigned char *) sought + max_word_length;
   char uppercase = 0;
+#ifndef IL2
+  if (flags & NORMALIZE) {
+    const int n = normalize_word(sought, copy);
+    if (n < 0) return results_count;
+    j = copy + n;
+    if (! (flags & (IGNORE_CASE | DISALLOW_LOWERCASE)))
+      for (const unsigned char * i = copy + 1; i < j; i++) if (tablelc[*i] != *i) uppercase = 1;
+  }
+  else
+#endif
   for (const unsigned char * i = (const unsigned char *) sought; *i && i < tmp; i++, j++) {
 #ifdef IL2
     *j = *i;
@@ -271,122 +540,546 @@ int fsa::find(const char * const sought, char * const results_buf, const char fl
     if (! (flags & (IGNORE_CASE | DISALLOW_LOWERCASE)) && j != copy && tablelc[*j] != *j) uppercase = 1;
   }
   input_len = j - copy;
+  oov_miss * miss = NULL;
+  if (flags & OOV_FILTER) {
+    if (! may_be_known(copy, input_len)) return results_count;
+    // results refused by a tag filter are not misses of the word
+    if (! res.filter) {
+      miss = oov_misses + (oov_hash(copy, input_len, tablelc) & (oov_misses_count - 1));
+      if (miss->owner == serial && miss->flags == flags && miss->length == input_len
+          && ! memcmp(miss->word, copy, input_len)) return results_count;
+    }
+  }
   *j = ':';
   *(j + 1) = '\0';
+  res.key_colon = (unsigned char *) strchr((char *) copy, ':') - copy;
+  // the copy is changed by the search, the word is saved for the cache first
+  unsigned char missed[max_word_length];
+  if (miss) memcpy(missed, copy, input_len);
 
   if (flags & (ADD_DIACRITICS | IGNORE_CASE)) {
-    const unsigned char * accent_table = table + 256 * (flags - 1);
+    const unsigned char * accent_table = flags_table(flags);
     if (flags & IGNORE_CASE) for (unsigned char * i = copy; *i; i++) *i = tablelc[*i];
-    accent_word(copy, 0, start, NULL, accent_table, res);
+    accent_word<G>(copy, 0, start, NULL, accent_table, res);
     if (uppercase) {
       for (unsigned char * i = (copy + 1); *i; i++) *i = tablelc[*i];
-      accent_word(copy, 0, start, NULL, accent_table, res);
+      accent_word<G>(copy, 0, start, NULL, accent_table, res);
     }
     if (tablelc[*copy] != *copy) {
       *copy = tablelc[*copy];
-      accent_word(copy, 0, start, NULL, accent_table, res);
+      accent_word<G>(copy, 0, start, NULL, accent_table, res);
     }
-    if ((! results_count) && start1 && start2) accent_word(copy, 0, start1, start2, accent_table, res);
+    if ((! results_count) && start1 && start2) accent_word<G>(copy, 0, start1, start2, accent_table, res);
   }
   else {
-    find_word(copy, 0, start, res);
+    find_word<G>(copy, 0, start, res);
     if (uppercase) {
       for (unsigned char * i = (copy + 1); *i; i++) *i = tablelc[*i];
-      find_word(copy, 0, start, res);
+      find_word<G>(copy, 0, start, res);
     }
     if (tablelc[*copy] != *copy && ! (flags & DISALLOW_LOWERCASE)) {
       *copy = tablelc[*copy];
-      find_word(copy, 0, start, res);
+      find_word<G>(copy, 0, start, res);
     }
     if (! results_count && start1 && start2) {
-      arc_pointer new_node, next_node = set_next_node(start1);
+      arc_pointer new_node, next_node = set_next_node<G>(start1);
       int level = 0;
       bool found = false;
       unsigned char * word = copy;
 
       do {
         found = false;
-        forallnodes(next_node, i)
+        forallnodes_g(next_node, i)
           if (*word == get_letter(next_node)) {
             candidate[level++] = get_letter(next_node);
             if (*++word == '\0') return results_count;
             found = true;
-            new_node = next_node = set_next_node(next_node);
+            new_node = next_node = set_next_node<G>(next_node);
             break;
           }
-        if (found) forallnodes(new_node, j)
+        if (found) forallnodes_g(new_node, j)
           if (':' == get_letter(new_node)) {
-            find_word(word, level, start2, res);
+            find_word<G>(word, level, start2, res);
             break;
           }
       } while (found);
     }
   }
+  if (miss && ! results_count) {
+    miss->owner = serial;
+    miss->flags = flags;
+    miss->length = input_len;
+    memcpy(miss->word, missed, input_len);
+  }
   return results_count;
 }
 
+template <int G>
 void fsa::accent_word(const unsigned char * const word, const int level, arc_pointer next_node, const arc_pointer start_node2, const unsigned char * accent_table, thread_specific &res) {
-  next_node = set_next_node(next_node);
+  next_node = set_next_node<G>(next_node);
   unsigned char	char_no;
-  forallnodes(next_node, i) {
+  forallnodes_g(next_node, i) {
     char_no = get_letter(next_node);
     if (*word == char_no || *word == accent_table[char_no]) {
       candidate[level] = get_letter(next_node);
-      if (word[1] == '\0' && ! start_node2) compl_rest(level + 1, next_node, res);
-      else accent_word(word + 1, level + 1, next_node, start_node2, accent_table, res);
+      if (word[1] == '\0' && ! start_node2) compl_rest<G>(level + 1, next_node, res);
+      else accent_word<G>(word + 1, level + 1, next_node, start_node2, accent_table, res);
     }
-    else if (get_letter(next_node) == ':' && start_node2) accent_word(word, level, start_node2, NULL, accent_table, res);
+    else if (get_letter(next_node) == ':' && start_node2) accent_word<G>(word, level, start_node2, NULL, accent_table, res);
   }
 }
 
+template <int G>
 void fsa::find_word(const unsigned char * word, int level, arc_pointer next_node, thread_specific &res) {
-  next_node = set_next_node(next_node);
+  next_node = set_next_node<G>(next_node);
   bool found;
   do {
     found = false;
-    forallnodes(next_node, i) {
+    forallnodes_g(next_node, i) {
       if (*word == get_letter(next_node)) {
         candidate[level++] = get_letter(next_node);
-	if (word[1] == '\0') compl_rest(level, next_node, res); else found = ++word;
+	if (word[1] == '\0') compl_rest<G>(level, next_node, res); else found = ++word;
 	break;
       }
     }
-    if (found) next_node = set_next_node(next_node);
+    if (found) next_node = set_next_node<G>(next_node);
   } while (found);
 }
 
-void fsa::compl_rest(const int depth, arc_pointer next_node, thread_specific &res) {
+// Prepares res for a lookup writing at most buf_size bytes of results into results_buf,
+// the candidate is kept at its end
+bool fsa::bounded(thread_specific &res, char * const results_buf, const size_t buf_size,
+                  word_match * const matches, const int max_matches, const tag_filter * const filter) {
+  if (buf_size < max_results_size) return false;
+  res.filter = tagged && filter && ! filter->empty() ? filter : NULL;
+  res.overflow = false;
+  candidate = (unsigned char *) results_buf + buf_size - (max_word_length + 2);
+  result = (unsigned char *) results_buf;
+  res.result_end = candidate - (max_word_length + 2);
+  results_count = 0;
+  res.matches = matches;
+  res.matches_count = 0;
+  res.max_matches = max_matches;
+  res.splits = NULL;
+  res.splits_count = res.max_splits = 0;
+  return true;
+}
+
+template <int G>
+int fsa::decompose_with(const char * const sought, char * const results_buf, const size_t buf_size,
+                        compound_split * const splits, const int max_splits, const char flags, const tag_filter * const filter) {
+  unsigned char copy[max_word_length + 1];
+  word_match match;
+  thread_specific res;
+
+  if (! bounded(res, results_buf, buf_size, &match, 1, filter)) return -1;
+  if (! start1 || ! start2 || internal_word(sought, copy, flags) < 0) return 0;
+  res.splits = splits;
+  res.max_splits = max_splits;
+  const unsigned char * const accent_table = flags_table(flags);
+  // parts are decoded with their keys, marks included
+  candidate[0] = '!';
+  compound_head<G>(copy, 1, start1, accent_table, res);
+  // the first parts are lowercase as words are
+  if (! res.splits_count && ! res.overflow && tablelc[*copy] != *copy && ! (flags & DISALLOW_LOWERCASE)) {
+    *copy = tablelc[*copy];
+    compound_head<G>(copy, 1, start1, accent_table, res);
+  }
+  return res.overflow ? -1 : res.splits_count;
+}
+
+// One walk for all the splits: every ':' on the path of the word ends a first part
+template <int G>
+void fsa::compound_head(const unsigned char * const word, const int level, arc_pointer next_node,
+                        const unsigned char * accent_table, thread_specific &res) {
+  next_node = set_next_node<G>(next_node);
+  if (next_node == dict) return;
+  forallnodes_g(next_node, i) {
+    const unsigned char char_no = get_letter(next_node);
+    if (res.overflow) return;
+
+    if (char_no == ':') {
+      word_match head;
+      // the rest is sought at the start of the candidate, the first part is kept aside
+      unsigned char letters[max_word_length];
+      if (level == 1 || ! *word || ! head_match<G>(level, next_node, head, res)) continue;
+      memcpy(letters, candidate, level);
+      candidate[0] = '^';
+      compound_tail<G>(word, 1, start2, head, level - 1, accent_table, res);
+      memcpy(candidate, letters, level);
+    }
+    else if (*word && (*word == char_no || (accent_table && *word == accent_table[char_no]))) {
+      candidate[level] = char_no;
+      compound_head<G>(word + 1, level + 1, next_node, accent_table, res);
+    }
+  }
+}
+
+template <int G>
+void fsa::compound_tail(const unsigned char * const word, const int level, arc_pointer next_node,
+                        const word_match &head, const int at, const unsigned char * accent_table,
+                        thread_specific &res) {
+  next_node = set_next_node<G>(next_node);
+  if (next_node == dict) return;
+  forallnodes_g(next_node, i) {
+    const unsigned char char_no = get_letter(next_node);
+    if (res.overflow) return;
+
+    if (char_no == ':') {
+      if (*word) continue;
+      if (res.splits_count == res.max_splits) {
+        res.overflow = true;
+        return;
+      }
+      res.matches_count = 0;
+      add_match<G>(level, next_node, 0, res);
+      if (res.matches_count) {
+        compound_split &split = res.splits[res.splits_count++];
+        split.at = at;
+        split.head = head;
+        split.tail = res.matches[0];
+        split.tail.word++;	// the '^'
+      }
+    }
+    else if (*word && (*word == char_no || (accent_table && *word == accent_table[char_no]))) {
+      candidate[level] = char_no;
+      compound_tail<G>(word + 1, level + 1, next_node, head, at, accent_table, res);
+    }
+  }
+}
+
+// The first part of the candidate of length level ('!' and the letters) with its results,
+// false if it has none
+template <int G>
+bool fsa::head_match(const int level, const arc_pointer colon, word_match &head, thread_specific &res) {
+  cached_head &cached = cached_heads[oov_hash(candidate, level, table) & (cached_heads_count - 1)];
+  if (cached.owner == serial && cached.length == level && ! memcmp(cached.head, candidate, level)) {
+    if (result + cached.size > res.result_end) {
+      res.overflow = true;
+      return false;
+    }
+    memcpy(result, cached.results, cached.size);
+    head.word = (const char *) result + 1;	// without the '!'
+    head.distance = 0;
+    head.results = head.word + strlen(head.word) + 1;
+    head.count = cached.count;
+    result += cached.size;
+    return true;
+  }
+
+  // the filter is of the rest
+  const tag_filter * const filter = res.filter;
+  unsigned char * const word_at = result;
+  res.filter = NULL;
+  res.matches_count = 0;
+  add_match<G>(level, colon, 0, res);
+  res.filter = filter;
+  if (! res.matches_count) return false;
+  head = res.matches[0];
+  head.word++;
+  if ((size_t) (result - word_at) <= sizeof(cached.results)) {
+    cached.owner = serial;
+    cached.length = level;
+    cached.size = result - word_at;
+    cached.count = head.count;
+    memcpy(cached.head, candidate, level);
+    memcpy(cached.results, word_at, cached.size);
+  }
+  return true;
+}
+
+// OOV_FILTER: false if no key of the automaton can match the word, whatever the case and
+// diacritics, as with ADD_DIACRITICS | IGNORE_CASE (table + 512). Words of compounds are
+// not keys, the filter is empty and passes anything then.
+bool fsa::may_be_known(const unsigned char * const word, const size_t len) {
+  call_once(oov_built, &fsa::build_oov_filter, this);
+  if (oov_filter.empty() || memchr(word, ':', len)) return true;	// the query spans the key
+  const uint64_t h = oov_hash(word, len, table + 512);
+  const uint64_t * const block = &oov_filter[(h & oov_mask) * 8];
+  uint64_t bits = (h >> 29 ^ h) * 0xbf58476d1ce4e5b9ULL;
+  for (int i = 0; i < oov_probes; i++, bits >>= 9)
+    if (! (block[(bits >> 6) & 7] >> (bits & 63) & 1)) return false;
+  return true;
+}
+
+void fsa::build_oov_filter(void) {
+  if (start1 && start2) return;
+  vector<uint64_t> hashes;
+  unsigned char key[max_word_length];
+  collect_keys(start, 0, key, hashes);
+
+  size_t blocks = 1;
+  while (blocks * 512 < hashes.size() * oov_bits_per_key) blocks <<= 1;
+  oov_filter.assign(blocks * 8, 0);
+  oov_mask = blocks - 1;
+  for (size_t k = 0; k < hashes.size(); k++) {
+    const uint64_t h = hashes[k];
+    uint64_t * const block = &oov_filter[(h & oov_mask) * 8];
+    uint64_t bits = (h >> 29 ^ h) * 0xbf58476d1ce4e5b9ULL;
+    for (int i = 0; i < oov_probes; i++, bits >>= 9) block[(bits >> 6) & 7] |= (uint64_t) 1 << (bits & 63);
+  }
+}
+
+// Hashes of the keys (up to the first ':') below the arc, key holds the level letters above it
+void fsa::collect_keys(arc_pointer next_node, const int level, unsigned char * const key, vector<uint64_t> &hashes) const {
   next_node = set_next_node(next_node);
   if (next_node == dict) return;
   forallnodes(next_node, i) {
+    if (get_letter(next_node) == ':') hashes.push_back(oov_hash(key, level, table + 512));
+    // longer keys cannot be sought
+    else if (level < max_word_length) {
+      key[level] = get_letter(next_node);
+      collect_keys(next_node, level + 1, key, hashes);
+    }
+  }
+}
+
+// Converts the word into copy (lowercase with IGNORE_CASE), returns its length or -1 if
+// it cannot be in the dictionary
+int fsa::internal_word(const char * const word, unsigned char * const copy, const char flags) const {
+  int n = 0;
+#ifndef IL2
+  if (flags & NORMALIZE) {
+    if ((n = normalize_word(word, copy)) < 0) return -1;
+    if (flags & IGNORE_CASE) for (int i = 0; i < n; i++) copy[i] = tablelc[copy[i]];
+  }
+  else
+#endif
+  for (const unsigned char * i = (const unsigned char *) word; *i && n < max_word_length; i++, n++) {
+#ifdef IL2
+    copy[n] = *i;
+#else
+    if (128 > *i) copy[n] = *i;
+    else if (*i > 194 && *i < 198) {
+      copy[n] = table3[*i - 195][*(i + 1)];
+      i++;
+    }
+    else return -1;
+#endif
+    if (flags & IGNORE_CASE) copy[n] = tablelc[copy[n]];
+  }
+  copy[n] = '\0';
+  return n;
+}
+
+#ifndef IL2
+// UTF-8 into copy as with table3, with combining marks composed with the preceding letter
+// (NFC) and confusable characters folded to ASCII. Returns the length of the word or -1
+// if it cannot be in the dictionary.
+int fsa::normalize_word(const char * const word, unsigned char * const copy) const {
+  int n = 0;
+  for (const unsigned char * i = (const unsigned char *) word; *i; ) {
+    unsigned char c;
+    if (*i < 128) c = *i++;
+    else if (*i >= 0xc2 && *i < 0xe0) {
+      if ((i[1] & 0xc0) != 0x80) return -1;
+      if (*i == 0xcc || *i == 0xcd) {
+        const unsigned char mark = marks[(*i - 0xcc) * 64 + (i[1] & 0x3f)];
+        if (! n || ! mark || copy[n - 1] > 127 || ! (c = compose[mark][copy[n - 1]])) return -1;
+        copy[n - 1] = c;
+        i += 2;
+        continue;
+      }
+      if (*i > 0xd1 || ! (c = utf2[*i - 0xc2][i[1] & 0x3f])) return -1;
+      i += 2;
+    }
+    else if ((*i & 0xf0) == 0xe0) {
+      if ((i[1] & 0xc0) != 0x80 || (i[2] & 0xc0) != 0x80) return -1;
+      const int code = (*i & 0x0f) << 12 | (i[1] & 0x3f) << 6 | (i[2] & 0x3f);
+      i += 3;
+      if (code >= 0x2000 && code < 0x2040) c = punct[code - 0x2000];
+      else if (code > 0xff00 && code < 0xff5f) c = code - 0xfee0;	// fullwidth ASCII
+      else if (code == 0x2212) c = '-';
+      else if (code == 0x3000) c = ' ';
+      else if (code == 0x2060 || code == 0xfeff) c = dropped;
+      else return -1;
+      if (! c) return -1;
+    }
+    else return -1;
+    if (c == dropped) continue;
+    if (n == max_word_length) break;
+    copy[n++] = c;
+  }
+  return n;
+}
+#endif
+
+// Letters of the dictionary are compared with those of the word also as mapped by the table
+const unsigned char * fsa::flags_table(const char flags) const {
+  return flags & (ADD_DIACRITICS | IGNORE_CASE) ? table + 256 * ((flags & (ADD_DIACRITICS | IGNORE_CASE)) - 1) : NULL;
+}
+
+// Writes the word (the candidate of length level) and its results following the ':' arc as
+// the next match, unless the filter refused all of them
+template <int G>
+void fsa::add_match(const int level, const arc_pointer colon, const int distance, thread_specific &res) {
+  if (res.matches_count == res.max_matches || result + 2 * level + 1 > res.result_end) {
+    res.overflow = true;
+    return;
+  }
+  word_match &match = res.matches[res.matches_count];
+  unsigned char * const word_at = result;
+  my_strncpy(result, candidate, level);
+  *result++ = '\0';
+  candidate[level] = ':';
+  input_len = res.key_colon = level;
+  const int before = results_count;
+  compl_rest<G>(level + 1, colon, res);
+  if (results_count == before) result = word_at;
+  else {
+    match.word = (const char *) word_at;
+    match.distance = distance;
+    match.results = (const char *) word_at + strlen((const char *) word_at) + 1;
+    match.count = results_count - before;
+    res.matches_count++;
+  }
+}
+
+template <int G>
+int fsa::fuzzy_with(const char * const sought, char * const results_buf, const size_t buf_size, const int max_distance,
+                    word_match * const matches, const int max_matches, const char flags, const tag_filter * const filter) {
+  unsigned char copy[max_word_length + 1];
+  unsigned char row[max_word_length + 1];
+  thread_specific res;
+
+  if (! bounded(res, results_buf, buf_size, matches, max_matches, filter)) return -1;
+  const int n = internal_word(sought, copy, flags);
+  if (n < 0) return 0;
+  // the first row: distances of the prefixes of the word to the empty candidate
+  for (int j = 0; j <= n; j++) row[j] = j;
+
+  fuzzy_word<G>(copy, n, 0, start, row, max_distance, flags_table(flags), res);
+  return res.overflow ? -1 : res.matches_count;
+}
+
+template <int G>
+void fsa::fuzzy_word(const unsigned char * const word, const int word_len, const int level, arc_pointer next_node,
+                     const unsigned char * const row, const int max_distance, const unsigned char * accent_table,
+                     thread_specific &res) {
+  unsigned char next[max_word_length + 1];
+  next_node = set_next_node<G>(next_node);
+  if (next_node == dict) return;
+  forallnodes_g(next_node, i) {
+    const unsigned char char_no = get_letter(next_node);
+    if (res.overflow) return;
+    // the sub-automata of compounds are not words
+    if (next_node == start1 || next_node == start2) continue;
+
+    if (char_no == ':') {
+      if (row[word_len] <= max_distance) add_match<G>(level, next_node, row[word_len], res);
+      continue;
+    }
+    if (level == max_word_length) continue;
+
+    // next row of the Levenshtein table, the subtree is pruned once all of it is over the limit
+    int best = next[0] = row[0] + 1;
+    for (int j = 1; j <= word_len; j++) {
+      int d = row[j - 1] + (word[j - 1] != char_no && ! (accent_table && word[j - 1] == accent_table[char_no]));
+      if (row[j] + 1 < d) d = row[j] + 1;
+      if (next[j - 1] + 1 < d) d = next[j - 1] + 1;
+      next[j] = d;
+      if (d < best) best = d;
+    }
+    if (best > max_distance) continue;
+    candidate[level] = char_no;
+    fuzzy_word<G>(word, word_len, level + 1, next_node, next, max_distance, accent_table, res);
+  }
+}
+
+template <int G>
+int fsa::complete_with(const char * const prefix, char * const results_buf, const size_t buf_size,
+                       word_match * const matches, const int max_matches, const char flags, const tag_filter * const filter) {
+  unsigned char copy[max_word_length + 1];
+  thread_specific res;
+
+  if (! bounded(res, results_buf, buf_size, matches, max_matches, filter)) return -1;
+  if (internal_word(prefix, copy, flags) < 0) return 0;
+  complete_word<G>(copy, 0, start, flags_table(flags), res);
+  return res.overflow ? -1 : res.matches_count;
+}
+
+// Follows the rest of the prefix (word), then enumerates the words of the subtree
+template <int G>
+void fsa::complete_word(const unsigned char * const word, const int level, arc_pointer next_node,
+                        const unsigned char * accent_table, thread_specific &res) {
+  next_node = set_next_node<G>(next_node);
+  if (next_node == dict) return;
+  forallnodes_g(next_node, i) {
+    const unsigned char char_no = get_letter(next_node);
+    if (res.overflow || res.matches_count == res.max_matches) return;
+    if (next_node == start1 || next_node == start2) continue;
+
+    if (char_no == ':') {
+      if (! *word) add_match<G>(level, next_node, 0, res);
+    }
+    else if (*word) {
+      if (*word == char_no || (accent_table && *word == accent_table[char_no])) {
+        candidate[level] = char_no;
+        complete_word<G>(word + 1, level + 1, next_node, accent_table, res);
+      }
+    }
+    else if (level < max_word_length) {
+      candidate[level] = char_no;
+      complete_word<G>(word, level + 1, next_node, accent_table, res);
+    }
+  }
+}
+
+// tag_at is the depth following the first ':' of the completion (the tag in w-lt), once it is known
+template <int G>
+void fsa::compl_rest(const int depth, arc_pointer next_node, thread_specific &res, const int tag_at) {
+  next_node = set_next_node<G>(next_node);
+  if (next_node == dict) return;
+  forallnodes_g(next_node, i) {
+    int rest_tag_at = tag_at;
     candidate[depth] = get_letter(next_node);
+    if (! tag_at) {
+      if (candidate[depth] == ':') rest_tag_at = depth + 1;
+    }
+    // prune the whole subtree as soon as a complete pair is refused
+    else if (res.filter && (depth - tag_at) & 1 && ! res.filter->accepts(candidate[depth - 1], candidate[depth])) continue;
     if (is_final(next_node)) {
       candidate[depth + 1] = '\0';
-      process_result(res);
-      results_count++;
+      // refused results are not even decoded
+      if (! res.filter || (rest_tag_at && res.filter->matches(candidate + rest_tag_at))) {
+        // a result takes at most two bytes per letter of the candidate and two terminators
+        if (res.result_end && result + 2 * (depth + 2) > res.result_end) {
+          res.overflow = true;
+          return;
+        }
+        (this->*process_result)(res, rest_tag_at, depth + 1);
+        results_count++;
+      }
     }
-    compl_rest(depth + 1, next_node, res);
+    compl_rest<G>(depth + 1, next_node, res, rest_tag_at);
   }
 }
 
-void fsa::process_result(thread_specific &res) { switch (type) { // not indented
+// result of the candidate up to the tag, then the tag itself unconverted
+#define copy_tagged(from) \
+  my_strncpy(result, from, candidate + tag_at - 1 - (from)); \
+  my_rawcpy(result, candidate + tag_at - 1, len - tag_at + 1)
+
+template <int T>
+void fsa::decode(thread_specific &res, const int tag_at, const int len) { switch (T) { // not indented
 
 case 1:   // w-lt
 case 4: { // l-wt
   my_strncpy(result, candidate, input_len - (candidate[input_len + 1] - 'A'));
-  my_strxcpy(result, candidate + input_len + 2);
+  copy_tagged(candidate + input_len + 2);
 } break;
 
 case 3: { // lt-w
-  // We want to allow l-tw queries also (we would have to check a presence of [the "first"] ':' in the query otherwise)
-  const unsigned char * const first = (unsigned char *) strchr((char *) candidate, ':');
+  // We want to allow l-tw queries also (the first ':' may be a part of the query)
+  const unsigned char * const first = candidate + res.key_colon;
   const unsigned char * second = candidate + input_len;
   if (first == second) {
-    second = (unsigned char *) strchr((char *) first + 1, ':');
+    second = candidate + tag_at - 1;
     my_strncpy(result, first + 1, second - first);
     }
   my_strncpy(result, candidate, first - candidate - (second[1] - 'A'));
-  my_strcpy(result, second + 2);
+  my_strncpy(result, second + 2, candidate + len - second - 2);
+  *result++ = '\0';
 } break;
 
 case 2:	  // w
@@ -394,7 +1087,8 @@ case 5:   // l-w
 case 6:   // w-l
 case 7: { // w-w
   my_strncpy(result, candidate, input_len - (candidate[input_len + 1] - 'A'));
-  my_strcpy(result, candidate + input_len + 2);
+  my_strncpy(result, candidate + input_len + 2, len - input_len - 2);
+  *result++ = '\0';
 } break;
 
 case 1 + 128: { // w-lt
@@ -403,7 +1097,7 @@ case 1 + 128: { // w-lt
   n -= candidate[input_len + 2] - 'A';
   if (n<0) n = 0;
   my_strncpy(result, candidate + prefix_len, (size_t) n);
-  my_strxcpy(result, candidate + input_len + 3);
+  copy_tagged(candidate + input_len + 3);
 } break;
 
 case 2 + 128: { // w
@@ -412,36 +1106,39 @@ case 2 + 128: { // w
 } break;
 
 case 3 + 128: { // lt-w
-  const unsigned char * const first = (unsigned char *) strchr((char *) candidate, ':');
+  const unsigned char * const first = candidate + res.key_colon;
   const unsigned char * second = candidate + input_len;
   if (first == second) {
-    second = (unsigned char *) strchr((char *) first + 1, ':');
+    second = candidate + tag_at - 1;
     my_strncpy(result, first + 1, second - first);
     }
   int prefix_len = second[1] - 'A';
   my_strncpy(result, second + 2, prefix_len);
   my_strncpy(result, candidate, first - candidate - (second[prefix_len + 2] - 'A'));
-  my_strcpy(result, second + prefix_len + 3);
+  my_strncpy(result, second + prefix_len + 3, candidate + len - second - prefix_len - 3);
+  *result++ = '\0';
 } break;
 
 case 4 + 128: { // l-wt
   int prefix_len = candidate[input_len + 1] - 'A';
   my_strncpy(result, candidate + input_len + 2, prefix_len);
   my_strncpy(result, candidate, input_len - (candidate[input_len + prefix_len + 2] - 'A'));
-  my_strxcpy(result, candidate + input_len + prefix_len + 3);
+  copy_tagged(candidate + input_len + prefix_len + 3);
 } break;
 
 case 5 + 128: { // l-w
   int prefix_len = candidate[input_len + 1] - 'A';
   my_strncpy(result, candidate + input_len + 2, prefix_len);
   my_strncpy(result, candidate, input_len - (candidate[input_len + prefix_len + 2] - 'A'));
-  my_strcpy(result, candidate + input_len + prefix_len + 3);
+  my_strncpy(result, candidate + input_len + prefix_len + 3, len - input_len - prefix_len - 3);
+  *result++ = '\0';
 } break;
 
 case 6 + 128: { // w-l
   int prefix_len = candidate[input_len + 1] - 'A';
   my_strncpy(result, candidate + prefix_len, input_len - prefix_len - (candidate[input_len + 2] - 'A'));
-  my_strcpy(result, candidate + input_len + 3);
+  my_strncpy(result, candidate + input_len + 3, len - input_len - 3);
+  *result++ = '\0';
 } break;
 
 case 7 + 128: { // w-w
@@ -449,11 +1146,83 @@ case 7 + 128: { // w-w
   my_strncpy(result, candidate + input_len + 2, prefix_add_len);
   int prefix_remove_len = candidate[input_len + 2 + prefix_add_len] - 'A';
   my_strncpy(result, candidate + prefix_remove_len, input_len - prefix_remove_len - (candidate[input_len + 3 + prefix_add_len] - 'A'));
-  my_strcpy(result, candidate + input_len + prefix_add_len + 4);
+  my_strncpy(result, candidate + input_len + prefix_add_len + 4, len - input_len - prefix_add_len - 4);
+  *result++ = '\0';
 } break;
-
-default:
-  cerr << "Invalid dictionary file (cannot interpret file of type " << (short int) type << ")" << endl;
-  // Yes, exiting from a library is rather ugly, but it should not happen and this is the simplest solution
-  exit(EXIT_FAILURE); // And of course it does not free the memory, but again, this should not happen :-)
 }}
+
+// Binds the decoder of the dictionary type, false if the type is not supported
+bool fsa::bind_decoder(void) {
+  switch (type) {
+    case 1: process_result = &fsa::decode<1>; break;
+    case 2: process_result = &fsa::decode<2>; break;
+    case 3: process_result = &fsa::decode<3>; break;
+    case 4: process_result = &fsa::decode<4>; break;
+    case 5: process_result = &fsa::decode<5>; break;
+    case 6: process_result = &fsa::decode<6>; break;
+    case 7: process_result = &fsa::decode<7>; break;
+    case 1 + 128: process_result = &fsa::decode<1 + 128>; break;
+    case 2 + 128: process_result = &fsa::decode<2 + 128>; break;
+    case 3 + 128: process_result = &fsa::decode<3 + 128>; break;
+    case 4 + 128: process_result = &fsa::decode<4 + 128>; break;
+    case 5 + 128: process_result = &fsa::decode<5 + 128>; break;
+    case 6 + 128: process_result = &fsa::decode<6 + 128>; break;
+    case 7 + 128: process_result = &fsa::decode<7 + 128>; break;
+    default: return false;
+  }
+  return true;
+}
+
+bool tag_filter::restrict(const unsigned char attribute, const char * values) {
+  restriction r;
+  r.attribute = attribute;
+  r.optional = false;
+  r.values[0] = r.values[1] = 0;
+  for (; *values; values++) {
+    const unsigned char value = *values;
+    if (value == '-') r.optional = true;
+    else if (value < 128) r.values[value >> 6] |= (uint64_t) 1 << (value & 63);
+    else return false;
+  }
+
+  for (int i = 0; i < count; i++)
+    if (restrictions[i].attribute == attribute) {
+      restrictions[i].optional &= r.optional;
+      restrictions[i].values[0] &= r.values[0];
+      restrictions[i].values[1] &= r.values[1];
+      return true;
+    }
+  if (count == max_attributes) return false;
+  restrictions[count++] = r;
+  return true;
+}
+
+bool tag_filter::parse(const char * pattern) {
+  char values[128];
+  while (*pattern) {
+    const unsigned char attribute = *pattern++;
+    size_t n = 0;
+    if (*pattern == '[') {
+      for (pattern++; *pattern && *pattern != ']'; pattern++)
+        if (n < sizeof(values) - 1) values[n++] = *pattern;
+      if (*pattern++ != ']') return false;
+    }
+    else if (*pattern) values[n++] = *pattern++;
+    else return false;
+    values[n] = '\0';
+    if (! restrict(attribute, values)) return false;
+  }
+  return true;
+}
+
+bool tag_filter::matches(const unsigned char * tag) const {
+  bool seen[max_attributes] = {false};
+  for (; tag[0] && tag[1]; tag += 2) {
+    const restriction * r = find(tag[0]);
+    if (! r) continue;
+    if (! accepts(tag[0], tag[1])) return false;
+    seen[r - restrictions] = true;
+  }
+  for (int i = 0; i < count; i++) if (! seen[i] && ! restrictions[i].optional) return false;
+  return true;
+}
@@ -5,9 +5,26 @@
 #define ADD_DIACRITICS		1
 #define IGNORE_CASE		2
 #define DISALLOW_LOWERCASE	4
+#define NORMALIZE		8	// compose combining marks (NFC) and fold confusables (UTF-8 only)
+#define OOV_FILTER		16	// reject unknown words before the traversal (Bloom filter, cache of misses)
+
+// residency of the automaton in memory, applied when it is loaded
+#define RESIDENT_HUGE_PAGES	1	// copied into transparent huge pages
+#define RESIDENT_HUGETLB	2	// copied into explicit (reserved) huge pages
+#define RESIDENT_PREFAULT	4	// all pages read in at once
+#define RESIDENT_LOCK		8	// locked in memory (mlock)
+
+#include	<stdint.h>
+#include	<iosfwd>
+#include	<mutex>
+#include	<vector>
 
 const int max_word_length = 100; // in bytes
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MAJKA_MMAP // automata are memory-mapped instead of read
+#endif
+
 using namespace std;
 
 inline size_t bytes2int(const unsigned char * addr, size_t len) {
@@ -18,11 +35,71 @@ typedef	const unsigned char *	arc_pointer;
 
 const int goto_offset = 1;
 
+// Restriction of results to those with matching attribute-value pairs in the compact tag
+class tag_filter {
+public:
+  tag_filter(void) : count(0) {}
+
+  // values: allowed value letters, '-' allows the attribute to be missing
+  // (restrictions of the same attribute intersect)
+  bool restrict(const unsigned char attribute, const char * values);
+  // pattern: pairs of attribute and value, alternative values in brackets, e.g. "k1c[14]e[A-]"
+  bool parse(const char * pattern);
+  bool empty(void) const { return ! count; }
+
+  // may the tag continue after the pair?
+  bool accepts(const unsigned char attribute, const unsigned char value) const {
+    const restriction * r = find(attribute);
+    return ! r || (value < 128 && (r->values[value >> 6] >> (value & 63)) & 1);
+  }
+  bool matches(const unsigned char * tag) const;
+
+private:
+  static const int	max_attributes = 16;
+  struct restriction {
+    unsigned char	attribute;
+    bool		optional;
+    uint64_t		values[2];
+  };
+  restriction		restrictions[max_attributes];
+  int			count;
+
+  const restriction * find(const unsigned char attribute) const {
+    for (int i = 0; i < count; i++) if (restrictions[i].attribute == attribute) return restrictions + i;
+    return NULL;
+  }
+};
+
 struct thread_specific {
   unsigned char *       candidate;
   unsigned char *       result;
   int                   results_count;
   size_t                input_len;
+  size_t                key_colon;	// position of the first ':' of the query
+  const tag_filter *    filter;
+  unsigned char *       result_end;	// results must not reach it (NULL if they fit surely)
+  bool                  overflow;	// a result or match did not fit
+  struct word_match *   matches;	// of fsa::find_fuzzy, fsa::complete
+  int                   matches_count;
+  int                   max_matches;
+  struct compound_split * splits;	// of fsa::decompose
+  int                   splits_count;
+  int                   max_splits;
+};
+
+// A word of the dictionary found by fsa::find_fuzzy or fsa::complete
+struct word_match {
+  const char *		word;		// UTF-8, in the results buffer
+  int			distance;	// edits from the sought word (0 for completions)
+  const char *		results;	// count results of the word as fsa::find writes them
+  int			count;
+};
+
+// A split of a compound word found by fsa::decompose, results of the first part are
+// those of its '!' key, results of the rest those of its '^' key
+struct compound_split {
+  int			at;		// letters of the first part
+  word_match		head, tail;	// distance is 0
 };
 
 class fsa {
@@ -32,20 +109,46 @@ public:
   int			results_count;
 #endif
   int			state;
+  int			resident;	// RESIDENT_* options which took effect
 
-  fsa(const char * const dict_name);
-  int find(const char * const sought, char * const results_buf, const char flags = 0);
+  // quiet: no messages on cerr if the dictionary cannot be loaded, state tells why
+  fsa(const char * const dict_name, const int residency = 0, const bool quiet = false);
+  // filter applies to dictionaries with tags in results (w-lt, l-wt)
+  int find(const char * const sought, char * const results_buf, const char flags = 0, const tag_filter * const filter = NULL) {
+    return (this->*find_kernel)(sought, results_buf, flags, filter);
+  }
+  // Words within max_distance edits (Levenshtein) of sought and their results, found by one
+  // walk of the automaton. results_buf has buf_size bytes, at least max_results_size.
+  // Returns the number of matches, -1 if results_buf or matches was too small.
+  int find_fuzzy(const char * const sought, char * const results_buf, const size_t buf_size, const int max_distance,
+                 word_match * const matches, const int max_matches, const char flags = 0, const tag_filter * const filter = NULL) {
+    return (this->*fuzzy_kernel)(sought, results_buf, buf_size, max_distance, matches, max_matches, flags, filter);
+  }
+  // Words starting with prefix and their results, at most max_matches of them in the order
+  // of the automaton. Buffers and the result as with find_fuzzy.
+  int complete(const char * const prefix, char * const results_buf, const size_t buf_size,
+               word_match * const matches, const int max_matches, const char flags = 0, const tag_filter * const filter = NULL) {
+    return (this->*complete_kernel)(prefix, results_buf, buf_size, matches, max_matches, flags, filter);
+  }
+  // All splits of sought into a first part of compounds and the rest, found by one walk
+  // of the first parts. The filter applies to the rest. Buffers and the result as with
+  // find_fuzzy (max_splits instead of max_matches).
+  int decompose(const char * const sought, char * const results_buf, const size_t buf_size,
+                compound_split * const splits, const int max_splits, const char flags = 0, const tag_filter * const filter = NULL) {
+    return (this->*decompose_kernel)(sought, results_buf, buf_size, splits, max_splits, flags, filter);
+  }
 #ifdef SWIG
   char * find_swig(const char * const sought, const char flags = 0) { results_count = find(sought, results_buf, flags); return results_buf; }
   char * find_swig(const char * const sought, char * const buffer, const char flags = 0) { results_count = find(sought, buffer, flags); return buffer; }
-  virtual ~fsa(void) { if (! state) { delete [] dict; delete [] results_buf; } }
-#else
-  virtual ~fsa(void) { if (! state) delete [] dict; }
 #endif
+  virtual ~fsa(void);
 
 private:
+  friend class fsa_builder;	// of majkac, uses the tables
+
   arc_pointer	 	dict;
   unsigned char		type;
+  bool			tagged;
   int			goto_length;
   char			version_major;
   unsigned short int	version_minor;
@@ -53,27 +156,90 @@ private:
   unsigned short int	max_results_count;
   unsigned int		_max_results_size;
   size_t		input_len;
+  size_t		mapped_len;
+  size_t		dict_size;
 #ifdef SWIG
   char *		results_buf;
 #endif
   arc_pointer		start;
   arc_pointer		start1, start2;
+  uint64_t		serial;		// unique per automaton, owner of cached misses
+  // OOV_FILTER: blocks of 512 bits, built at the first lookup with the flag
+  vector<uint64_t>	oov_filter;
+  size_t		oov_mask;
+  once_flag		oov_built;
   unsigned char		table[3 * 256];
   unsigned char		tablelc[256];
 #ifdef UTF
   unsigned char		table1[256], table2[256], table3[3][256];
+  // NORMALIZE: letters of two-byte sequences C2-D1, of General Punctuation (U+2000-U+203F),
+  // combining marks (U+0300-U+036F) to rows of compose, ASCII letters with those marks
+  unsigned char		utf2[16][64], punct[64], marks[128], compose[11][128];
 #endif
 
-  int read_fsa(const char * const dict_file_name);
-  void find_word(const unsigned char * word, const int level, arc_pointer next_node, thread_specific &res);
-  void accent_word(const unsigned char * const word, const int level, arc_pointer next_node, const arc_pointer start_node2, const unsigned char * accent_table, thread_specific &res);
-  void compl_rest(const int depth, arc_pointer next_node, thread_specific &res);
-  void process_result(thread_specific &res);
+  fsa(void);	// no automaton, the tables only
+  void init_tables(void);
+  int read_fsa(const char * const dict_file_name, ostream &log);
+#ifdef MAJKA_MMAP
+  arc_pointer map_fsa(const char * const dict_file_name, const size_t file_size);
+#endif
+  void free_fsa(void);
+  int make_resident(const int options);
+  // Traversal kernels are specialized on the width of go_to fields (1-4 bytes, 0 for
+  // any width read from goto_length), the one for the dictionary is chosen at load.
+  int (fsa::*find_kernel)(const char * const sought, char * const results_buf, const char flags, const tag_filter * const filter);
+  template <int G> int find_with(const char * const sought, char * const results_buf, const char flags, const tag_filter * const filter);
+  template <int G> void find_word(const unsigned char * word, const int level, arc_pointer next_node, thread_specific &res);
+  template <int G> void accent_word(const unsigned char * const word, const int level, arc_pointer next_node, const arc_pointer start_node2, const unsigned char * accent_table, thread_specific &res);
+  int (fsa::*fuzzy_kernel)(const char * const sought, char * const results_buf, const size_t buf_size, const int max_distance,
+                           word_match * const matches, const int max_matches, const char flags, const tag_filter * const filter);
+  template <int G> int fuzzy_with(const char * const sought, char * const results_buf, const size_t buf_size, const int max_distance,
+                                  word_match * const matches, const int max_matches, const char flags, const tag_filter * const filter);
+  // row: edit distances of the prefixes of word to the candidate of length level
+  template <int G> void fuzzy_word(const unsigned char * const word, const int word_len, const int level, arc_pointer next_node,
+                                   const unsigned char * const row, const int max_distance, const unsigned char * accent_table,
+                                   thread_specific &res);
+  int (fsa::*complete_kernel)(const char * const prefix, char * const results_buf, const size_t buf_size,
+                              word_match * const matches, const int max_matches, const char flags, const tag_filter * const filter);
+  template <int G> int complete_with(const char * const prefix, char * const results_buf, const size_t buf_size,
+                                     word_match * const matches, const int max_matches, const char flags, const tag_filter * const filter);
+  template <int G> void complete_word(const unsigned char * const word, const int level, arc_pointer next_node,
+                                      const unsigned char * accent_table, thread_specific &res);
+  int (fsa::*decompose_kernel)(const char * const sought, char * const results_buf, const size_t buf_size,
+                               compound_split * const splits, const int max_splits, const char flags, const tag_filter * const filter);
+  template <int G> int decompose_with(const char * const sought, char * const results_buf, const size_t buf_size,
+                                      compound_split * const splits, const int max_splits, const char flags, const tag_filter * const filter);
+  // Follows the rest of the word in the '!' automaton, the candidate holds '!' and level - 1 letters
+  template <int G> void compound_head(const unsigned char * const word, const int level, arc_pointer next_node,
+                                      const unsigned char * accent_table, thread_specific &res);
+  // Splits of the rest of the word after the first part at the colon
+  template <int G> void compound_tail(const unsigned char * const word, const int level, arc_pointer next_node,
+                                      const word_match &head, const int at, const unsigned char * accent_table,
+                                      thread_specific &res);
+  template <int G> bool head_match(const int level, const arc_pointer colon, word_match &head, thread_specific &res);
+  template <int G> void bind_kernels(void);
+  bool bounded(thread_specific &res, char * const results_buf, const size_t buf_size,
+               word_match * const matches, const int max_matches, const tag_filter * const filter);
+  int internal_word(const char * const word, unsigned char * const copy, const char flags) const;
+  void build_oov_filter(void);
+  void collect_keys(arc_pointer next_node, const int level, unsigned char * const key, vector<uint64_t> &hashes) const;
+  bool may_be_known(const unsigned char * const word, const size_t len);
+  int normalize_word(const char * const word, unsigned char * const copy) const;
+  const unsigned char * flags_table(const char flags) const;
+  template <int G> void add_match(const int level, const arc_pointer colon, const int distance, thread_specific &res);
+  template <int G> void compl_rest(const int depth, arc_pointer next_node, thread_specific &res, const int tag_at = 0);
+  // Writes the result of the candidate of length len, whose part after the first ':' of
+  // the completion starts at tag_at (0 if there is none). Bound to the type at load.
+  void (fsa::*process_result)(thread_specific &res, const int tag_at, const int len);
+  template <int T> void decode(thread_specific &res, const int tag_at, const int len);
+  bool bind_decoder(void);
 
   arc_pointer first_node() const { return dict + goto_offset + goto_length; }
-  arc_pointer set_next_node(const arc_pointer arc) const { return arc[goto_offset] & 4
+  template <int G> int goto_width() const { return G ? G : goto_length; }
+  template <int G> arc_pointer set_next_node(const arc_pointer arc) const { return arc[goto_offset] & 4
     ? arc + goto_offset + 1
-    : dict + (bytes2int(arc + goto_offset, goto_length) >> 3); }
+    : dict + (bytes2int(arc + goto_offset, goto_width<G>()) >> 3); }
+  arc_pointer set_next_node(const arc_pointer arc) const { return set_next_node<0>(arc); }
   unsigned char get_letter(const arc_pointer arc) const { return *arc; }
   int is_final(const arc_pointer arc) const { return arc[goto_offset] & 1; }
 
@@ -93,22 +259,11 @@ void my_strcpy(unsigned char * &dest, const unsigned char * src) {
   dest += j + 1;
 }
 
-void my_strxcpy(unsigned char * &dest, const unsigned char * src) {
-  size_t j = 0, i = 0;
-  for (; src[i] != ':'; i++, j++)
-#ifdef IL2
-    dest[j] = src[i];
-#else
-    if (src[i] > 127) {
-      dest[j] = table1[src[i]];
-      dest[++j] = table2[src[i]];
-    }
-    else dest[j] = src[i];
-#endif
-  src += i; dest += j;
-  for (i = 0; src[i]; i++) dest[i] = src[i];
-  dest[i] = '\0';
-  dest += i + 1;
+// n bytes, no conversion, and the terminating '\0'
+void my_rawcpy(unsigned char * &dest, const unsigned char * src, size_t n) {
+  memcpy(dest, src, n);
+  dest[n] = '\0';
+  dest += n + 1;
 }
 
 void my_strncpy(unsigned char * &dest, const unsigned char * src, size_t n) {
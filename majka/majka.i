@@ -1,6 +1,7 @@
 %module Majka
 
-%ignore fsa::find(const char * const sought, char * const results_buf, const char flags = 0);
+%ignore fsa::find(const char * const sought, char * const results_buf, const char flags = 0, const tag_filter * const filter = NULL);
+%ignore tag_filter;
 %ignore fsa::results_count;
 
 %rename (find) find_swig;
@@ -25,11 +26,61 @@
 }
 
 %{
+#include <vector>
 #include "majka.h"
+
+/* Buffers of the reentrant variants, one per thread (and ithread) */
+static char * majka_thread_buffer(const fsa * const majka) {
+	static thread_local std::vector<char> buffer;
+	if (buffer.size() < majka->max_results_size) buffer.resize(majka->max_results_size);
+	return &buffer[0];
+}
+
+static SV * majka_results_ref(pTHX_ const char * results, const int count) {
+	AV *av = newAV();
+	av_extend(av, count);
+	for (int i = 0; i < count; i++) {
+	    int l = strlen(results);
+	    av_push(av, newSVpvn(results, l));
+	    results += l + 1;
+	};
+	return newRV_noinc((SV*)av);
+}
 %}
 
+%typemap(out) SV * fsa::find_r, SV * fsa::find_many {
+	$result = sv_2mortal($1);
+	argvi++;
+}
+
 %include "majka.h"
 
+%extend fsa {
+	SV * find_r(const char * const sought, const char flags = 0) {
+		dTHX;
+		char * buffer = majka_thread_buffer($self);
+		int count = $self->find(sought, buffer, flags);
+		return majka_results_ref(aTHX_ buffer, count);
+	}
+
+	SV * find_many(SV * words, const char flags = 0) {
+		dTHX;
+		char * buffer = majka_thread_buffer($self);
+		AV *input, *output;
+		if (!SvROK(words) || SvTYPE(SvRV(words)) != SVt_PVAV)
+		    croak("find_many expects a reference to an array of words");
+		input = (AV*)SvRV(words);
+		output = newAV();
+		av_extend(output, av_len(input) + 1);
+		for (SSize_t i = 0; i <= av_len(input); i++) {
+		    SV **word = av_fetch(input, i, 0);
+		    int count = $self->find(word && SvOK(*word) ? SvPV_nolen(*word) : "", buffer, flags);
+		    av_push(output, majka_results_ref(aTHX_ buffer, count));
+		};
+		return newRV_noinc((SV*)output);
+	}
+}
+
 %perlcode %{
 
 =cut
@@ -56,6 +107,21 @@ perl -MMajka -ne '
 	print map "$_\n", @{$m->find($_, $buffer)};
 	' < data
 
+$m->find_r($word, [flags]) is a reentrant variant of $m->find($word, [flags])
+safe to be used from several ithreads at once. The results are written into
+a buffer private to the calling thread.
+
+$m->find_many(\@words, [flags]) analyzes all words in one call and returns
+a reference to an array of references to arrays of analyses, in the order
+of words. It is reentrant as well. Example of use:
+
+perl -MMajka -e '
+	my $m = Majka->new("majka.w-lt");
+	chomp(my @words = <STDIN>);
+	my $results = $m->find_many(\@words);
+	print "$words[$_]:", join(":", @{$results->[$_]}), "\n" for 0 .. $#words;
+	' < data
+
 $m->{state} is equal to 0 if the automaton was successfully initialized,
 non-zero otherwise.
 
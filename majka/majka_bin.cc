@@ -15,6 +15,8 @@ int main(const int argc, const char *argv[]) {
     if (! strcmp(argv[i], "-d")) flags |= ADD_DIACRITICS;
     if (! strcmp(argv[i], "-i")) flags |= IGNORE_CASE;
     if (! strcmp(argv[i], "-l")) flags |= DISALLOW_LOWERCASE;
+    if (! strcmp(argv[i], "-n")) flags |= NORMALIZE;
+    if (! strcmp(argv[i], "-o")) flags |= OOV_FILTER;
     if (! strcmp(argv[i], "-h")) {
       cerr << MAJKA_VERSION << endl;
       cerr << "-f file  dictionary file" << endl
@@ -22,6 +24,8 @@ int main(const int argc, const char *argv[]) {
            << "-d       add diacritics" << endl
            << "-i       ignore case (analyze john as John; Dog/DOG is always analyzed as dog unless -l)" << endl
            << "-l       do NOT lowercase (analyze JOHN as John or Dog/DOG as dog)" << endl
+           << "-n       normalize the input (compose accents, fold typographic characters)" << endl
+           << "-o       filter out unknown words before the search (the filter is built at the first word)" << endl
            << "-h       help" << endl;
       return 0;
       }
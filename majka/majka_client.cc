@@ -0,0 +1,151 @@
+/* Client of the lookup daemon (majkad) */
+
+#include	<string.h>
+#include	<stdlib.h>
+#include	<errno.h>
+#include	<unistd.h>
+#include	<sys/socket.h>
+#include	<sys/time.h>
+#include	<sys/un.h>
+#include	"majka.h"
+#include	"majka_client.h"
+#include	"majka_protocol.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0	// SIGPIPE is to be ignored then
+#endif
+
+static bool write_all(const int fd, const char * data, size_t size) {
+  while (size) {
+    const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool read_all(const int fd, char * data, size_t size) {
+  while (size) {
+    const ssize_t n = read(fd, data, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+daemon_client::daemon_client(const char * const socket, const char * const dictionary)
+  : path(socket), dictionary(dictionary), fd(-1), last_id(0) {
+  std::lock_guard<std::mutex> guard(lock);
+  connect();
+}
+
+daemon_client::~daemon_client(void) {
+  disconnect();
+}
+
+void daemon_client::disconnect(void) {
+  if (fd >= 0) close(fd);
+  fd = -1;
+}
+
+bool daemon_client::connect(void) {
+  sockaddr_un address;
+  std::string response;
+
+  disconnect();
+  if (path.size() >= sizeof(address.sun_path) || dictionary.size() > 255) return false;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return false;
+  // a daemon which accepts but hangs must not block the lookups forever
+  timeval timeout;
+  timeout.tv_sec = daemon_timeout;
+  timeout.tv_usec = 0;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0
+      || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+    disconnect();
+    return false;
+  }
+  // a request without words tells whether the dictionary is served
+  if (::connect(fd, (sockaddr *) &address, sizeof(address)) < 0
+      || ! exchange(NULL, 0, 0, response) || (uint8_t) response[4] != majkad_ok) {
+    disconnect();
+    return false;
+  }
+  return true;
+}
+
+bool daemon_client::exchange(const char * const * words, const size_t count, const char flags, std::string &response) {
+  std::string request;
+  const uint32_t id = ++last_id;
+
+  put_u32(request, 0);	// the size, once known
+  put_u32(request, id);
+  request.push_back(flags);
+  request.push_back((char) dictionary.size());
+  request.append(dictionary);
+  put_u32(request, count);
+  for (size_t i = 0; i < count; i++) {
+    size_t length = strlen(words[i]);
+    if (length > max_word_length) length = max_word_length;	// the rest is ignored by fsa::find
+    put_u16(request, length);
+    request.append(words[i], length);
+  }
+  if (request.size() - 4 > majkad_max_frame) return false;
+  std::string size;
+  put_u32(size, request.size() - 4);
+  request.replace(0, 4, size);
+
+  char header[4];
+  if (! write_all(fd, request.data(), request.size()) || ! read_all(fd, header, 4)) return false;
+  const uint32_t length = get_u32(header);
+  if (length < 9 || length > majkad_max_frame) return false;
+  response.resize(length);
+  // the only request in flight, so the response must be its one
+  return read_all(fd, &response[0], length) && get_u32(response.data()) == id;
+}
+
+bool daemon_client::find(const char * const * words, const size_t count, const char flags,
+                         const tag_filter * const filter, std::vector<char> &out, std::vector<int> &counts) {
+  std::lock_guard<std::mutex> guard(lock);
+  std::string response;
+
+  // lookups have no side effects, a failed one (or timed out, the late response would
+  // be read as the next one) may be repeated on a new connection
+  if ((fd < 0 || ! exchange(words, count, flags, response))
+      && (! connect() || ! exchange(words, count, flags, response))) {
+    disconnect();
+    return false;
+  }
+
+  frame_reader frame(response.data(), response.size());
+  uint32_t id, words_count, length;
+  uint8_t status;
+  uint16_t results_count;
+  const char * results;
+  if (! frame.u32(id) || ! frame.u8(status) || ! frame.u32(words_count)
+      || status != majkad_ok || words_count != count) return false;
+  for (size_t i = 0; i < count; i++) {
+    if (! frame.u16(results_count) || ! frame.u32(length) || ! frame.bytes(results, length)) return false;
+    int kept = 0;
+    const char * entry = results;
+    for (uint16_t r = 0; r < results_count; r++) {
+      const char * const end = (const char *) memchr(entry, '\0', results + length - entry);
+      if (! end) return false;
+      const char * const tag = (const char *) memchr(entry, ':', end - entry);
+      if (! filter || ! tag || filter->matches((const unsigned char *) tag + 1)) {
+        out.insert(out.end(), entry, end + 1);
+        kept++;
+      }
+      entry = end + 1;
+    }
+    if (entry != results + length) return false;
+    counts.push_back(kept);
+  }
+  return frame.done();
+}
@@ -0,0 +1,51 @@
+/* Client of the lookup daemon (majkad) */
+
+#ifndef MAJKA_CLIENT_H
+#define MAJKA_CLIENT_H
+
+#include	<stddef.h>
+#include	<stdint.h>
+#include	<mutex>
+#include	<string>
+#include	<vector>
+
+class tag_filter;	// see majka.h
+
+// Seconds a connect, send or receive may block before the daemon is taken for lost
+const int daemon_timeout = 5;
+
+// One connection, lookups of several threads take turns on it
+class daemon_client {
+public:
+  // Connects to the daemon listening on socket and checks that it serves the
+  // dictionary (by its path, an empty one for the default dictionary)
+  daemon_client(const char * const socket, const char * const dictionary);
+  virtual ~daemon_client(void);
+
+  bool ready(void) const { return fd >= 0; }
+  const std::string & socket_path(void) const { return path; }
+  const std::string & dictionary_path(void) const { return dictionary; }
+
+  // Appends results of the words accepted by filter to out and their counts to counts,
+  // as fsa::find would. Reconnects once if the connection was lost, returns false if
+  // the daemon is not available.
+  bool find(const char * const * words, const size_t count, const char flags,
+            const tag_filter * const filter, std::vector<char> &out, std::vector<int> &counts);
+
+private:
+  std::string	path;
+  std::string	dictionary;
+  int		fd;
+  uint32_t	last_id;
+  std::mutex	lock;
+
+  bool connect(void);
+  void disconnect(void);
+  // Sends a request of the words and receives the response
+  bool exchange(const char * const * words, const size_t count, const char flags, std::string &response);
+
+  daemon_client(const daemon_client &);
+  daemon_client & operator=(const daemon_client &);
+};
+
+#endif
@@ -0,0 +1,111 @@
+/* C interface of libmajka.so for foreign function interfaces */
+
+#include	<string.h>
+#include	<new>
+#include	<string>
+#include	"majka.h"
+#include	"majka_ffi.h"
+
+struct majka_handle {
+  fsa *		majka;
+};
+
+const int	known_flags = ADD_DIACRITICS | IGNORE_CASE | DISALLOW_LOWERCASE | NORMALIZE | OOV_FILTER;
+
+int majka_version(void) {
+  return MAJKA_FFI_VERSION;
+}
+
+const char * majka_strerror(const int status) {
+  switch (status) {
+    case MAJKA_OK: return "Success";
+    case MAJKA_E_ARGUMENT: return "Invalid argument";
+    case MAJKA_E_OPEN: return "Cannot read the dictionary file";
+    case MAJKA_E_FORMAT: return "Invalid or unsupported dictionary file";
+    case MAJKA_E_MEMORY: return "Out of memory";
+    case MAJKA_E_FILTER: return "Invalid tag filter";
+    case MAJKA_E_SPACE: return "Output arena too small";
+  }
+  return "Unknown status";
+}
+
+int majka_open(const char * const path, const int residency, majka_handle ** const handle) {
+  if (! handle) return MAJKA_E_ARGUMENT;
+  *handle = NULL;
+  if (! path) return MAJKA_E_ARGUMENT;
+
+  fsa * const majka = new (nothrow) fsa(path, residency, true);
+  if (! majka) return MAJKA_E_MEMORY;
+  // fsa::state is the return value of fsa::read_fsa
+  switch (majka->state) {
+    case 0: break;
+    case 2: case 3: case 4: case 7: delete majka; return MAJKA_E_OPEN;
+    default: delete majka; return MAJKA_E_FORMAT;
+  }
+  if (! (*handle = new (nothrow) majka_handle)) {
+    delete majka;
+    return MAJKA_E_MEMORY;
+  }
+  (*handle)->majka = majka;
+  return MAJKA_OK;
+}
+
+void majka_close(majka_handle * const handle) {
+  if (! handle) return;
+  delete handle->majka;
+  delete handle;
+}
+
+size_t majka_result_size(const majka_handle * const handle) {
+  return handle ? handle->majka->max_results_size : 0;
+}
+
+size_t majka_batch_bound(const majka_handle * const handle, const size_t count) {
+  return majka_result_size(handle) * count;
+}
+
+int majka_find_batch(const majka_handle * const handle, const char * const data, const size_t * const offsets,
+                     const size_t count, const int flags, const char * const filter,
+                     char * const arena, const size_t arena_size, size_t * const at, int * const counts,
+                     size_t * const used) {
+  if (! handle || (count && (! data || ! offsets)) || (flags & ~known_flags) || ! used
+      || (arena_size && ! arena)) return MAJKA_E_ARGUMENT;
+  tag_filter check;
+  if (filter && ! check.parse(filter)) return MAJKA_E_FILTER;
+
+  try {
+    fsa * const majka = handle->majka;
+    string word, results(majka->max_results_size, '\0');
+    bool fits = true;
+
+    *used = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (offsets[i + 1] < offsets[i]) return MAJKA_E_ARGUMENT;
+      word.assign(data + offsets[i], offsets[i + 1] - offsets[i]);
+      const int found = majka->find(word.c_str(), &results[0], flags, filter ? &check : NULL);
+      // results are consecutive NUL terminated strings
+      const char * end = results.data();
+      for (int r = 0; r < found; r++) end += strlen(end) + 1;
+      const size_t size = end - results.data();
+
+      if (fits && *used + size <= arena_size) {
+        memcpy(arena + *used, results.data(), size);
+        if (at) at[i] = *used;
+        if (counts) counts[i] = found;
+      }
+      else fits = false;
+      *used += size;
+    }
+    if (fits && at) at[count] = *used;
+    return fits ? MAJKA_OK : MAJKA_E_SPACE;
+  }
+  catch (const bad_alloc &) {
+    return MAJKA_E_MEMORY;
+  }
+}
+
+int majka_batch_size(const majka_handle * const handle, const char * const data, const size_t * const offsets,
+                     const size_t count, const int flags, const char * const filter, size_t * const size) {
+  const int status = majka_find_batch(handle, data, offsets, count, flags, filter, NULL, 0, NULL, NULL, size);
+  return status == MAJKA_E_SPACE ? MAJKA_OK : status;
+}
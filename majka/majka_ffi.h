@@ -0,0 +1,95 @@
+/* C interface of libmajka.so for foreign function interfaces
+ *
+ * Usage:
+ *
+ *   majka_handle * handle;
+ *   if (majka_open("majka.w-lt", 0, &handle) != MAJKA_OK) ...;
+ *
+ *   // words "psa" and "dělala" packed one after another, word i is
+ *   // data[offsets[i]] up to data[offsets[i + 1]]
+ *   const char data[] = "psadělala";
+ *   const size_t offsets[] = {0, 3, 10};
+ *   size_t at[3], used;
+ *   int counts[2];
+ *   size_t size = majka_batch_bound(handle, 2);	// or majka_batch_size
+ *   char * arena = malloc(size);
+ *   int status = majka_find_batch(handle, data, offsets, 2, MAJKA_ADD_DIACRITICS, NULL,
+ *                                 arena, size, at, counts, &used);
+ *   // results of word i are counts[i] NUL terminated "lemma:tag" strings (UTF-8)
+ *   // starting at arena + at[i], at[2] == used
+ *   majka_close(handle);
+ *
+ * A handle may be used by any number of threads at once, all functions but
+ * majka_open and majka_close are reentrant. Nothing is written to stderr.
+ */
+
+#ifndef MAJKA_FFI_H
+#define MAJKA_FFI_H
+
+#include	<stddef.h>
+
+#define MAJKA_FFI_VERSION	1
+
+// flags of the lookups, as in majka.h
+#define MAJKA_ADD_DIACRITICS	1
+#define MAJKA_IGNORE_CASE	2
+#define MAJKA_DISALLOW_LOWERCASE	4
+#define MAJKA_NORMALIZE		8
+#define MAJKA_OOV_FILTER	16
+
+// residency options of majka_open, as RESIDENT_* in majka.h
+#define MAJKA_RESIDENT_HUGE_PAGES	1
+#define MAJKA_RESIDENT_HUGETLB		2
+#define MAJKA_RESIDENT_PREFAULT		4
+#define MAJKA_RESIDENT_LOCK		8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum majka_status {
+  MAJKA_OK = 0,
+  MAJKA_E_ARGUMENT = -1,	// a NULL handle or pointer, unknown flags
+  MAJKA_E_OPEN = -2,		// the dictionary file cannot be opened or read
+  MAJKA_E_FORMAT = -3,		// the file is not a dictionary this library reads
+  MAJKA_E_MEMORY = -4,
+  MAJKA_E_FILTER = -5,		// invalid tag filter
+  MAJKA_E_SPACE = -6		// the output arena is too small
+};
+
+// A loaded dictionary
+typedef struct majka_handle majka_handle;
+
+// MAJKA_FFI_VERSION of the library
+int majka_version(void);
+// Description of a status, a static string
+const char * majka_strerror(const int status);
+
+// Loads the dictionary, *handle is set to NULL unless MAJKA_OK is returned
+int majka_open(const char * const path, const int residency, majka_handle ** const handle);
+void majka_close(majka_handle * const handle);
+
+// Bytes of results one word may have at most
+size_t majka_result_size(const majka_handle * const handle);
+// Bytes of arena enough for any count words
+size_t majka_batch_bound(const majka_handle * const handle, const size_t count);
+
+// Looks up count words packed in data, word i is data[offsets[i]] up to data[offsets[i + 1]]
+// (offsets has count + 1 items). filter is a pattern of tag_filter::parse, e.g. "k1c[14]",
+// or NULL. The results of word i are counts[i] NUL terminated strings in arena starting at
+// arena + at[i] (at has count + 1 items, at[count] is the size of all results). *used is set
+// to the size of all results even if MAJKA_E_SPACE is returned, at and counts are valid then
+// for the words before the first one whose results did not fit.
+int majka_find_batch(const majka_handle * const handle, const char * const data, const size_t * const offsets,
+                     const size_t count, const int flags, const char * const filter,
+                     char * const arena, const size_t arena_size, size_t * const at, int * const counts,
+                     size_t * const used);
+// Exact size of the arena majka_find_batch needs for the words (the words are looked up)
+int majka_batch_size(const majka_handle * const handle, const char * const data, const size_t * const offsets,
+                     const size_t count, const int flags, const char * const filter, size_t * const size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+/* Mutable lexicon of additional words on top of an automaton */
+
+#include	<string.h>
+#include	<stdlib.h>
+#include	<algorithm>
+#include	"majka.h"
+#include	"majka_overlay.h"
+
+// Serialized form: magic, number of words in decimal NUL terminated, then for every
+// word (sorted) the length of the prefix shared
+// with the previous word (1 byte), the rest of the word and its entries, all NUL
+// terminated, and an empty string ending the entries.
+static const char overlay_magic[] = "\fovl\1";
+
+static size_t count_entries(const std::string &list) {
+  size_t n = 0;
+  for (size_t i = 0; i < list.size(); i++) if (! list[i]) n++;
+  return n;
+}
+
+static bool has_entry(const std::string &list, const char * const entry) {
+  for (size_t i = 0; i < list.size(); i += strlen(&list[i]) + 1)
+    if (! strcmp(&list[i], entry)) return true;
+  return false;
+}
+
+// entry "lemma" also matches all stored entries "lemma:tag"
+static bool entry_matches(const char * const stored, const char * const entry) {
+  const size_t length = strlen(entry);
+  return ! strncmp(stored, entry, length)
+    && (! stored[length] || (stored[length] == ':' && ! strchr(entry, ':')));
+}
+
+overlay::overlay(void) : map(new words()), entries(0) {}
+
+void overlay::publish(words * const next) {
+  size_t n = 0;
+  for (words::const_iterator it = next->begin(); it != next->end(); ++it)
+    n += count_entries(it->second);
+  map.publish(next);
+  entries = n;
+}
+
+size_t overlay::add(const std::vector<item> &items) {
+  std::lock_guard<std::mutex> guard(map.lock);
+  words * const next = new words(*map.get());
+  size_t added = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    std::string &list = (*next)[items[i].first];
+    if (has_entry(list, items[i].second.c_str())) continue;
+    list.append(items[i].second.c_str(), strlen(items[i].second.c_str()) + 1);
+    added++;
+  }
+  if (added) publish(next);
+  else delete next;
+  return added;
+}
+
+size_t overlay::remove(const char * const word, const char * const entry) {
+  std::lock_guard<std::mutex> guard(map.lock);
+  words::const_iterator found = map.get()->find(word);
+  if (found == map.get()->end()) return 0;
+
+  std::string kept;
+  for (size_t i = 0; i < found->second.size(); i += strlen(&found->second[i]) + 1)
+    if (entry && ! entry_matches(&found->second[i], entry))
+      kept.append(&found->second[i], strlen(&found->second[i]) + 1);
+  const size_t removed = count_entries(found->second) - count_entries(kept);
+  if (! removed) return 0;
+
+  words * const next = new words(*map.get());
+  if (kept.empty()) next->erase(word);
+  else (*next)[word] = kept;
+  publish(next);
+  return removed;
+}
+
+void overlay::clear(void) {
+  std::lock_guard<std::mutex> guard(map.lock);
+  publish(new words());
+}
+
+int overlay::find(const char * const word, std::vector<char> &results,
+                  const tag_filter * const filter) const {
+  rcu<words>::reader current(map);
+  words::const_iterator found = current->find(word);
+  if (found == current->end()) return 0;
+
+  int count = 0;
+  for (size_t i = 0; i < found->second.size(); i += strlen(&found->second[i]) + 1) {
+    const char * const entry = &found->second[i];
+    const char * const tag = strchr(entry, ':');
+    if (filter && tag && ! filter->matches((const unsigned char *) tag + 1)) continue;
+    results.insert(results.end(), entry, entry + strlen(entry) + 1);
+    count++;
+  }
+  return count;
+}
+
+std::string overlay::dump(void) const {
+  std::vector<const words::value_type *> sorted;
+  std::string data(overlay_magic, sizeof(overlay_magic) - 1);
+  const std::string * previous = NULL;
+
+  rcu<words>::reader current(map);
+  for (words::const_iterator it = current->begin(); it != current->end(); ++it)
+    sorted.push_back(&*it);
+  std::sort(sorted.begin(), sorted.end(),
+            [](const words::value_type * a, const words::value_type * b) { return a->first < b->first; });
+
+  data.append(std::to_string(sorted.size())).push_back('\0');
+  for (size_t i = 0; i < sorted.size(); i++) {
+    const std::string &word = sorted[i]->first;
+    size_t shared = 0;
+    if (previous)
+      while (shared < 255 && shared < word.size() && shared < previous->size()
+             && word[shared] == (*previous)[shared]) shared++;
+    data.push_back((char) shared);
+    data.append(word.c_str() + shared, word.size() - shared + 1);
+    data.append(sorted[i]->second);
+    data.push_back('\0');
+    previous = &word;
+  }
+  return data;
+}
+
+bool overlay::load(const char * const data, const size_t length) {
+  const size_t magic = sizeof(overlay_magic) - 1;
+  if (length < magic || memcmp(data, overlay_magic, magic)) return false;
+
+  const char * const count_end = (const char *) memchr(data + magic, '\0', length - magic);
+  if (! count_end) return false;
+  const size_t count = strtoul(data + magic, NULL, 10);
+
+  words * const next = new words();
+  std::string word;
+  size_t i = count_end - data + 1;
+  bool valid = true;
+  while (valid && i < length) {
+    const size_t shared = (unsigned char) data[i++];
+    const char * end = (const char *) memchr(data + i, '\0', length - i);
+    if (shared > word.size() || ! end) {
+      valid = false;
+      break;
+    }
+    word = word.substr(0, shared) + std::string(data + i, end);
+    i = end - data + 1;
+
+    std::string list;
+    for (;;) {
+      const char * const entry = data + i;
+      end = (const char *) memchr(entry, '\0', length - i);
+      if (! end) { valid = false; break; }	// truncated
+      i += end - entry + 1;
+      if (end == entry) break;
+      list.append(entry, end - entry + 1);
+    }
+    if (list.empty()) valid = false;
+    (*next)[word] = list;
+  }
+  if (! valid || i != length || next->size() != count) {
+    delete next;
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(map.lock);
+  publish(next);
+  return true;
+}
@@ -0,0 +1,55 @@
+/* Mutable lexicon of additional words on top of an automaton */
+
+#ifndef MAJKA_OVERLAY_H
+#define MAJKA_OVERLAY_H
+
+#include	<atomic>
+#include	<string>
+#include	<unordered_map>
+#include	<utility>
+#include	<vector>
+#include	"majka_rcu.h"
+
+class tag_filter;	// see majka.h
+
+// Entries are kept in the output format of fsa::find, i.e. "lemma:tag" in UTF-8.
+// Lookups are lock-free, every update copies the map and publishes the copy
+// (see rcu), so bulk changes should be done by one call.
+class overlay {
+public:
+  typedef std::pair<std::string, std::string>	item;	// word, entry
+
+  overlay(void);
+  virtual ~overlay(void) {}
+
+  // Adds entries not present yet, returns how many were added
+  size_t add(const std::vector<item> &items);
+  // Removes the entry of the word, all entries of the lemma if entry has no tag,
+  // or all entries of the word if entry is NULL. Returns how many were removed.
+  size_t remove(const char * const word, const char * const entry = NULL);
+  void clear(void);
+
+  size_t size(void) const { return entries.load(std::memory_order_relaxed); }
+  bool empty(void) const { return ! size(); }
+
+  // Appends NUL terminated entries of the word accepted by filter to results,
+  // returns their count
+  int find(const char * const word, std::vector<char> &results,
+           const tag_filter * const filter = NULL) const;
+
+  // Compact serialized form, words are sorted and front coded
+  std::string dump(void) const;
+  // Replaces all entries, returns false if data is not a dumped overlay
+  bool load(const char * const data, const size_t length);
+
+private:
+  // word -> its NUL terminated entries
+  typedef std::unordered_map<std::string, std::string>	words;
+
+  rcu<words>		map;
+  std::atomic<size_t>	entries;
+
+  void publish(words * const next);
+};
+
+#endif
@@ -0,0 +1,41 @@
+/* Fixed-size pool of native worker threads */
+
+#include	"majka_pool.h"
+
+pool::pool(unsigned int threads) : stopping(false) {
+  if (! threads) threads = std::thread::hardware_concurrency();
+  if (! threads) threads = 1;
+  for (unsigned int i = 0; i < threads; i++) workers.push_back(std::thread(&pool::run, this));
+}
+
+pool::~pool(void) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void pool::submit(const std::function<void ()> &task) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    tasks.push_back(task);
+  }
+  wake.notify_one();
+}
+
+void pool::run(void) {
+  for (;;) {
+    std::function<void ()> task;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [this] { return stopping || ! tasks.empty(); });
+      // pending tasks are drained before the workers quit
+      if (tasks.empty()) return;
+      task = tasks.front();
+      tasks.pop_front();
+    }
+    task();
+  }
+}
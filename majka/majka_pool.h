@@ -0,0 +1,33 @@
+/* Fixed-size pool of native worker threads */
+
+#ifndef MAJKA_POOL_H
+#define MAJKA_POOL_H
+
+#include	<condition_variable>
+#include	<deque>
+#include	<functional>
+#include	<mutex>
+#include	<thread>
+#include	<vector>
+
+class pool {
+public:
+  // threads == 0 means one worker per hardware thread
+  pool(unsigned int threads = 0);
+  // waits for all submitted tasks to finish
+  virtual ~pool(void);
+
+  void submit(const std::function<void ()> &task);
+  unsigned int size(void) const { return workers.size(); }
+
+private:
+  std::vector<std::thread>		workers;
+  std::deque<std::function<void ()> >	tasks;
+  std::mutex				lock;
+  std::condition_variable		wake;
+  bool					stopping;
+
+  void run(void);
+};
+
+#endif
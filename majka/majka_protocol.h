@@ -0,0 +1,71 @@
+/* Binary protocol of the lookup daemon (majkad) */
+
+#ifndef MAJKA_PROTOCOL_H
+#define MAJKA_PROTOCOL_H
+
+#include	<stddef.h>
+#include	<stdint.h>
+#include	<string>
+
+// Every message is a frame: a u32 size of the rest of the frame and the rest.
+// All numbers are little endian.
+//
+// Request:  u32 id, u8 flags, u8 length of the dictionary name, the name,
+//           u32 number of words, every word as u16 length and the word (UTF-8).
+// Response: u32 id (of the request), u8 status, u32 number of words, for every
+//           word u16 number of results, u32 length of the results and the results
+//           NUL terminated as fsa::find writes them.
+//
+// A request without words only checks that the dictionary is served. An empty
+// name selects the first dictionary of the daemon. Responses to the requests of
+// one connection may come in any order.
+
+const uint32_t	majkad_max_frame = 64 << 20;
+
+enum majkad_status {
+  majkad_ok = 0,
+  majkad_unknown_dictionary = 1,
+  majkad_malformed = 2,
+};
+
+inline void put_u16(std::string &out, const uint16_t value) {
+  out.push_back((char) (value & 0xff));
+  out.push_back((char) (value >> 8));
+}
+
+inline void put_u32(std::string &out, const uint32_t value) {
+  for (int i = 0; i < 32; i += 8) out.push_back((char) ((value >> i) & 0xff));
+}
+
+inline uint16_t get_u16(const char * const at) {
+  const unsigned char * const p = (const unsigned char *) at;
+  return p[0] | p[1] << 8;
+}
+
+inline uint32_t get_u32(const char * const at) {
+  const unsigned char * const p = (const unsigned char *) at;
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// Reads values of a frame, every read past its end fails
+class frame_reader {
+public:
+  frame_reader(const char * const data, const size_t size) : at(data), end(data + size) {}
+
+  bool u8(uint8_t &value) { if (end - at < 1) return false; value = *at++; return true; }
+  bool u16(uint16_t &value) { if (end - at < 2) return false; value = get_u16(at); at += 2; return true; }
+  bool u32(uint32_t &value) { if (end - at < 4) return false; value = get_u32(at); at += 4; return true; }
+  bool bytes(const char * &data, const size_t size) {
+    if ((size_t) (end - at) < size) return false;
+    data = at;
+    at += size;
+    return true;
+  }
+  bool done(void) const { return at == end; }
+
+private:
+  const char *	at;
+  const char *	end;
+};
+
+#endif
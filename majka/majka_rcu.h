@@ -0,0 +1,71 @@
+/* Pointer to shared read-mostly data, replaced read-copy-update style */
+
+#ifndef MAJKA_RCU_H
+#define MAJKA_RCU_H
+
+#include	<atomic>
+#include	<mutex>
+#include	<thread>
+
+// Readers never block: they register in the counter of the current epoch and
+// read the pointer. A writer publishes a new object, moves to the next epoch
+// and waits until the readers of the previous one are gone before deleting
+// the old object. Writers are serialized by lock.
+template <class T>
+class rcu {
+public:
+  class reader {
+  public:
+    reader(const rcu<T> &owner) : owner(owner) {
+      for (;;) {
+        const unsigned int epoch = owner.epoch.load();
+        slot = epoch & 1;
+        ++owner.readers[slot];
+        if (owner.epoch.load() == epoch) break;
+        --owner.readers[slot];	// a writer moved on meanwhile
+      }
+      data = owner.current.load();
+    }
+    ~reader(void) { --owner.readers[slot]; }
+
+    const T * operator->(void) const { return data; }
+    const T * get(void) const { return data; }
+
+  private:
+    const rcu<T> &	owner;
+    unsigned int	slot;
+    const T *		data;
+
+    reader(const reader &);
+    reader & operator=(const reader &);
+  };
+
+  rcu(T * const initial) : current(initial), epoch(0) {
+    readers[0] = readers[1] = 0;
+  }
+  virtual ~rcu(void) { delete current.load(); }
+
+  // Current object, only for writers holding lock
+  const T * get(void) const { return current.load(); }
+
+  // Replaces the object, returns once no reader can see the old one and it is deleted.
+  // Must not be called by a thread holding a reader.
+  void publish(T * const next) {
+    T * const old = current.exchange(next);
+    const unsigned int previous = epoch.fetch_add(1);
+    while (readers[previous & 1].load()) std::this_thread::yield();
+    delete old;
+  }
+
+  std::mutex		lock;
+
+private:
+  std::atomic<T *>		current;
+  mutable std::atomic<unsigned int>	epoch;
+  mutable std::atomic<long>	readers[2];
+
+  rcu(const rcu &);
+  rcu & operator=(const rcu &);
+};
+
+#endif
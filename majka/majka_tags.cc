@@ -0,0 +1,70 @@
+/* Compact tags (new tagset reference, e.g. cs, sk) packed into 64 bits */
+
+#include	<string.h>
+#include	"majka_tags.h"
+
+const packed_field packed_fields[packed_fields_count] = {
+  {'k', "1234567890I"},		// part of speech
+  {'e', "AN"},			// negation
+  {'a', "PI"},			// aspect
+  {'m', "FIRANSDB"},		// mode
+  {'p', "0123456789"},		// person
+  {'g', "MIFN"},		// gender
+  {'n', "SPD"},			// number
+  {'c', "0123456789"},		// case
+  {'d', "0123456789"},		// degree
+  {'x', "PFODTCRS.,\"()~"},	// type
+  {'y', "FQRNI"},		// type
+  {'t', "SDTACLMQ"},		// type
+  {'z', "SYA"},			// subclass
+  {'w', "BHNRZ"},		// style
+  {'~', "0123456789"},		// frequency
+};
+
+// field of an attribute + 1 and field value of a value letter, 0 if there are none
+class packed_tables {
+public:
+  unsigned char	field[128];
+  unsigned char	code[packed_fields_count][128];
+
+  packed_tables(void) {
+    memset(field, 0, sizeof(field));
+    memset(code, 0, sizeof(code));
+    for (int i = 0; i < packed_fields_count; i++) {
+      field[(unsigned char) packed_fields[i].attribute] = i + 1;
+      for (int j = 0; packed_fields[i].values[j]; j++)
+        code[i][(unsigned char) packed_fields[i].values[j]] = j + 1;
+    }
+  }
+};
+
+static const packed_tables tables;
+
+uint64_t pack_tag(const char * tag, const char ** other) {
+  uint64_t packed = 0;
+  for (; *tag; tag += 2) {
+    const unsigned char attribute = tag[0], value = tag[1];
+    const int field = attribute < 128 ? tables.field[attribute] - 1 : -1;
+    const uint64_t code = field >= 0 && value < 128 ? tables.code[field][value] : 0;
+    const uint64_t current = field >= 0 ? (packed >> packed_shift(field)) & 15 : 0;
+    if (! code || (current && current != code)) {
+      if (other) *other = tag;
+      return packed | packed_overflow;
+    }
+    packed |= code << packed_shift(field);
+  }
+  if (other) *other = NULL;
+  return packed;
+}
+
+size_t unpack_tag(const uint64_t packed, char * tag) {
+  size_t n = 0;
+  for (int i = 0; i < packed_fields_count; i++) {
+    const int code = (packed >> packed_shift(i)) & 15;
+    if (! code || code > (int) strlen(packed_fields[i].values)) continue;
+    tag[n++] = packed_fields[i].attribute;
+    tag[n++] = packed_fields[i].values[code - 1];
+  }
+  tag[n] = '\0';
+  return n;
+}
@@ -0,0 +1,33 @@
+/* Compact tags (new tagset reference, e.g. cs, sk) packed into 64 bits */
+
+#ifndef MAJKA_TAGS_H
+#define MAJKA_TAGS_H
+
+#include	<stddef.h>
+#include	<stdint.h>
+
+// Every attribute has a 4 bits wide field, field value 0 means the attribute is missing,
+// otherwise it is the position of the value letter in values + 1.
+struct packed_field {
+  char		attribute;
+  const char *	values;
+};
+
+const int packed_fields_count = 15;
+extern const packed_field packed_fields[packed_fields_count];
+
+// The tag contains something that could not be packed, see the other argument of pack_tag
+const uint64_t packed_overflow = (uint64_t) 1 << 63;
+
+inline int packed_shift(const int field) { return 4 * field; }
+
+// Packs the attribute-value pairs of the tag in any order. At the first pair
+// that cannot be packed (unknown attribute or value, repeated attribute with a
+// different value) the overflow bit is set and *other points to the rest of the tag.
+uint64_t pack_tag(const char * tag, const char ** other = NULL);
+
+// Writes the packed pairs in the order of packed_fields, tag must hold 2 * packed_fields_count + 1 bytes.
+// Returns the length of the tag.
+size_t unpack_tag(const uint64_t packed, char * tag);
+
+#endif
@@ -0,0 +1,661 @@
+/* Compiler of dictionaries: builds the minimal automaton of a list of entries in the
+   format read by fsa::read_fsa, incrementally as in Daciuk, Mihov, Watson & Watson:
+   Incremental Construction of Minimal Acyclic Finite-State Automata (2000) */
+
+#include	<iostream>
+#include	<stdio.h>
+#include	<string.h>
+#include	<stdlib.h>
+#include	<stdint.h>
+#include	<algorithm>
+#include	<condition_variable>
+#include	<functional>
+#include	<memory>
+#include	<mutex>
+#include	<queue>
+#include	<string>
+#include	<thread>
+#include	<unordered_set>
+#include	<utility>
+#include	<vector>
+#include	"majka.h"
+#include	"majka_pool.h"
+
+// An arc of the automaton being built, finality belongs to arcs as in the file
+struct build_arc {
+  unsigned char		letter;
+  bool			final;
+  uint32_t		target;		// node + 1, 0 if the arc leads nowhere
+};
+
+// What the results of one lookup may take, written into the signature
+struct results_limits {
+  size_t		result;		// bytes of the longest result
+  size_t		count;		// results of one lookup
+  size_t		size;		// bytes of the results of one lookup
+};
+
+static size_t common(const std::string &a, const size_t i, const std::string &b, const size_t j) {
+  size_t n = 0;
+  while (i + n < a.size() && j + n < b.size() && a[i + n] == b[j + n]) n++;
+  return n;
+}
+
+// lengths are stored as letters from 'A' on
+static char code(const size_t n) { return (char) ('A' + n); }
+
+class fsa_builder {
+public:
+  fsa_builder(const int type);
+
+  bool supported(void) const;
+  // Converts the line key:value[:tag] into the string of the automaton and the bytes
+  // of its result as fsa::find writes it, false if it cannot be in the dictionary
+  bool encode(const char * const line, const size_t length, std::string &entry, size_t &result_size) const;
+  // Key of the entry as compared by fsa::find with ADD_DIACRITICS | IGNORE_CASE, the
+  // results of one lookup are those of the entries of one folded key at most
+  void fold(const std::string &entry, std::string &key) const;
+  // Entries must come sorted and distinct
+  void add(const std::string &entry);
+  // Writes the automaton, goto_length 0 chooses the narrowest go_to fields that fit
+  bool write(const char * const file_name, int goto_length, const results_limits &limits);
+  size_t nodes(void) const { return first.size() - 1; }
+  size_t arcs_count(void) const { return arcs.size(); }
+
+private:
+  struct node_hash {
+    const fsa_builder *	builder;
+    node_hash(const fsa_builder * const builder) : builder(builder) {}
+    size_t operator()(const uint32_t node) const;
+  };
+  struct node_equal {
+    const fsa_builder *	builder;
+    node_equal(const fsa_builder * const builder) : builder(builder) {}
+    bool operator()(const uint32_t a, const uint32_t b) const;
+  };
+
+  fsa			tables;
+  int			type;
+  std::vector<build_arc>	arcs;		// of the frozen nodes, node by node
+  std::vector<uint32_t>	first;		// first arc of every node and the end
+  std::unordered_set<uint32_t, node_hash, node_equal>	registered;
+  std::vector<std::vector<build_arc> >	path;	// nodes of the last entry, not frozen yet
+  std::string		previous;
+
+  bool internal(const char * from, const char * const to, std::string &out) const;
+  size_t external_size(const std::string &s) const;
+  void freeze(const size_t depth);
+  // The node equivalent to arcs (+ 1), registered as a new one if there is none
+  uint32_t enter(const std::vector<build_arc> &node);
+};
+
+fsa_builder::fsa_builder(const int type)
+  : type(type), registered(1 << 16, node_hash(this), node_equal(this)), path(max_word_length + 2) {
+  first.push_back(0);
+}
+
+bool fsa_builder::supported(void) const {
+  return (type >= 1 && type <= 7) || (type >= 1 + 128 && type <= 7 + 128);
+}
+
+// UTF-8 to the internal ISO-8859-2, false for letters fsa::find cannot convert back
+bool fsa_builder::internal(const char * from, const char * const to, std::string &out) const {
+  out.clear();
+  for (const unsigned char * i = (const unsigned char *) from; i < (const unsigned char *) to; i++) {
+    if (! *i) return false;
+#ifdef IL2
+    out += (char) *i;
+#else
+    if (128 > *i) out += (char) *i;
+    else if (*i > 194 && *i < 198 && i + 1 < (const unsigned char *) to && tables.table3[*i - 195][i[1]] != 32) {
+      out += (char) tables.table3[*i - 195][i[1]];
+      i++;
+    }
+    else return false;
+#endif
+  }
+  return true;
+}
+
+size_t fsa_builder::external_size(const std::string &s) const {
+  size_t n = s.size();
+#ifndef IL2
+  for (size_t i = 0; i < s.size(); i++) if ((unsigned char) s[i] > 127) n++;
+#endif
+  return n;
+}
+
+bool fsa_builder::encode(const char * const line, const size_t length, std::string &entry, size_t &result_size) const {
+  const char * const end = line + length;
+  const char * const colon = (const char *) memchr(line, ':', length);
+  // w-lt, l-wt with the tag at the end, lt-w with the tag following the key
+  const bool tagged = (type & 127) == 1 || (type & 127) == 4 || (type & 127) == 3;
+  const char * const second = colon && tagged ? (const char *) memchr(colon + 1, ':', end - colon - 1) : NULL;
+  std::string key, value, tag;
+
+  if (! internal(line, colon ? colon : end, key) || key.empty() || key.size() > (size_t) max_word_length) return false;
+  if (type != 2 + 128) {
+    if (! colon || (tagged && ! second)) return false;
+    if (! internal(colon + 1, tagged ? second : end, value)) return false;
+  }
+  if (tagged) {
+    if ((type & 127) == 3) {
+      if (! internal(second + 1, end, tag) || tag.find(':') != std::string::npos) return false;
+    }
+    else tag.assign(second + 1, end);	// copied unconverted by fsa::find
+  }
+
+  size_t best = 0, at = 0, from = 0;	// the longest part of the key in the value and where
+  entry = key + ':';
+  switch (type) {
+    case 1: case 4:
+      best = common(key, 0, value, 0);
+      entry += code(key.size() - best) + value.substr(best) + ':' + tag;
+      break;
+    case 2: case 5: case 6: case 7:
+      best = common(key, 0, value, 0);
+      entry += code(key.size() - best) + value.substr(best);
+      break;
+    case 3:
+      best = common(key, 0, value, 0);
+      entry += tag + ':' + code(key.size() - best) + value.substr(best);
+      break;
+    case 1 + 128: case 6 + 128:	// a part of the key without a prefix
+      for (size_t p = 0; p <= key.size(); p++) {
+        const size_t n = common(key, p, value, 0);
+        if (n > best) best = n, from = p;
+      }
+      entry += code(from);
+      entry += code(key.size() - from - best) + value.substr(best);
+      if (type == 1 + 128) entry += ':' + tag;
+      break;
+    case 2 + 128:
+      entry += 'A';	// any letter, the result is the key
+      break;
+    case 3 + 128: case 4 + 128: case 5 + 128:	// a prefix and the beginning of the key
+      for (size_t p = 0; p <= value.size(); p++) {
+        const size_t n = common(key, 0, value, p);
+        if (n > best) best = n, at = p;
+      }
+      if (type == 3 + 128) entry += tag + ':';
+      entry += code(at) + value.substr(0, at) + code(key.size() - best) + value.substr(at + best);
+      if (type == 4 + 128) entry += ':' + tag;
+      break;
+    case 7 + 128:	// a prefix and a part of the key
+      for (size_t p = 0; p <= value.size(); p++)
+        for (size_t r = 0; r <= key.size(); r++) {
+          const size_t n = common(key, r, value, p);
+          if (n > best) best = n, at = p, from = r;
+        }
+      entry += code(at) + value.substr(0, at) + code(from);
+      entry += code(key.size() - from - best) + value.substr(at + best);
+      break;
+  }
+  // the whole entry is the candidate of fsa::find
+  if (entry.size() > (size_t) max_word_length + 1) return false;
+
+  switch (type & 127) {
+    case 1: case 4: result_size = external_size(value) + 1 + tag.size() + 1; break;
+    case 3: result_size = external_size(tag) + 1 + external_size(value) + 1; break;
+    default: result_size = external_size(type == 2 + 128 ? key : value) + 1;
+  }
+  return true;
+}
+
+void fsa_builder::fold(const std::string &entry, std::string &key) const {
+  key.assign(entry, 0, entry.find(':'));
+  for (size_t i = 0; i < key.size(); i++) key[i] = (char) tables.table[512 + (unsigned char) key[i]];
+}
+
+size_t fsa_builder::node_hash::operator()(const uint32_t node) const {
+  size_t h = 14695981039346656037ULL;
+  for (uint32_t i = builder->first[node]; i < builder->first[node + 1]; i++) {
+    const build_arc &a = builder->arcs[i];
+    h = (h ^ (a.letter | a.final << 8 | (size_t) a.target << 9)) * 1099511628211ULL;
+  }
+  return h;
+}
+
+bool fsa_builder::node_equal::operator()(const uint32_t a, const uint32_t b) const {
+  const uint32_t n = builder->first[a + 1] - builder->first[a];
+  if (n != builder->first[b + 1] - builder->first[b]) return false;
+  const build_arc * const x = &builder->arcs[builder->first[a]];
+  const build_arc * const y = &builder->arcs[builder->first[b]];
+  for (uint32_t i = 0; i < n; i++)
+    if (x[i].letter != y[i].letter || x[i].final != y[i].final || x[i].target != y[i].target) return false;
+  return true;
+}
+
+uint32_t fsa_builder::enter(const std::vector<build_arc> &node) {
+  if (node.empty()) return 0;
+  // the node is appended tentatively, to be looked up as any other
+  arcs.insert(arcs.end(), node.begin(), node.end());
+  first.push_back(arcs.size());
+  const uint32_t n = first.size() - 2;
+  const std::pair<std::unordered_set<uint32_t, node_hash, node_equal>::iterator, bool> found = registered.insert(n);
+  if (! found.second) {
+    first.pop_back();
+    arcs.resize(first.back());
+  }
+  return *found.first + 1;
+}
+
+// Nodes of the previous entry deeper than depth will not change any more
+void fsa_builder::freeze(const size_t depth) {
+  for (size_t d = previous.size(); d > depth; d--) {
+    path[d - 1].back().target = enter(path[d]);
+    path[d].clear();
+  }
+}
+
+void fsa_builder::add(const std::string &entry) {
+  const size_t p = common(previous, 0, entry, 0);
+  freeze(p);
+  for (size_t i = p; i < entry.size(); i++) {
+    const build_arc a = { (unsigned char) entry[i], i + 1 == entry.size(), 0 };
+    path[i].push_back(a);
+  }
+  previous = entry;
+}
+
+static void put_bytes(std::vector<unsigned char> &out, uint64_t value, const int length) {
+  for (int i = 0; i < length; i++, value >>= 8) out.push_back((unsigned char) (value & 0xff));
+}
+
+bool fsa_builder::write(const char * const file_name, int goto_length, const results_limits &limits) {
+  freeze(0);
+  const uint32_t root = enter(path[0]);
+  path[0].clear();
+  previous.clear();
+  if (! root) {
+    cerr << "No entries to build a dictionary of" << endl;
+    return false;
+  }
+
+  // the null arc and the start arc precede the nodes, addresses keep three bits of flags
+  if (! goto_length)
+    for (goto_length = 1; goto_length < 8 && ((2 + arcs.size()) * (1 + goto_length)) >> (8 * goto_length - 3); goto_length++);
+  const uint64_t size = (2 + arcs.size()) * (1 + goto_length);
+  if (goto_length > 8 || size >> (8 * goto_length - 3)) {
+    cerr << "The automaton does not fit go_to fields of " << goto_length << " bytes" << endl;
+    return false;
+  }
+  if (limits.size > 0xffffffffULL - 2 * (max_word_length + 2)) {
+    cerr << "Results of one lookup would take " << limits.size << " bytes" << endl;
+    return false;
+  }
+  const size_t arc_size = 1 + goto_length;
+
+  // written aside and renamed, processes with the old file mapped keep reading it intact
+  const std::string temporary = std::string(file_name) + ".tmp";
+  FILE * const file = fopen(temporary.c_str(), "wb");
+  if (! file) {
+    cerr << "Cannot create dictionary file " << temporary << endl;
+    return false;
+  }
+  std::vector<unsigned char> out;
+  out.insert(out.end(), (const unsigned char *) "\\fsa", (const unsigned char *) "\\fsa" + 4);
+  out.push_back(5);			// ver
+  out.push_back('_');			// filler
+  out.push_back('+');			// annot_sep
+  out.push_back(goto_length);
+  out.push_back(type);
+  out.push_back(1);			// version_major
+  put_bytes(out, 0, 2);			// version_minor
+  put_bytes(out, std::min(limits.result, (size_t) 0xffff), 2);
+  put_bytes(out, std::min(limits.count, (size_t) 0xffff), 2);
+  put_bytes(out, limits.size, 4);
+
+  out.push_back(0);			// the null arc, a node of its own
+  put_bytes(out, 2, goto_length);
+  out.push_back(0);			// the start arc
+  put_bytes(out, (2 + first[root - 1]) * arc_size << 3, goto_length);
+
+  bool ok = true;
+  for (size_t n = 0; n + 1 < first.size() && ok; n++) {
+    for (uint32_t i = first[n]; i < first[n + 1]; i++) {
+      const build_arc &a = arcs[i];
+      const uint64_t address = a.target ? (2 + first[a.target - 1]) * arc_size : 0;
+      out.push_back(a.letter);
+      put_bytes(out, address << 3 | a.final | (i + 1 == first[n + 1]) << 1, goto_length);
+    }
+    if (out.size() >= 1 << 20) {
+      ok = fwrite(&out[0], 1, out.size(), file) == out.size();
+      out.clear();
+    }
+  }
+  if (ok && ! out.empty()) ok = fwrite(&out[0], 1, out.size(), file) == out.size();
+  if (fclose(file) || ! ok || rename(temporary.c_str(), file_name)) {
+    cerr << "Cannot write dictionary file " << file_name << endl;
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Sorted runs of strings, kept in memory up to a limit and spilled into temporary
+// files (every string as u16 length and the bytes) beyond it
+class runs {
+public:
+  runs(const size_t memory) : memory(memory), used(0) {}
+  virtual ~runs(void) { for (size_t i = 0; i < files.size(); i++) fclose(files[i]); }
+
+  bool add(std::vector<std::string> &strings);
+  // Calls take(string, count) for every distinct string in order, count of its runs
+  template <class F> bool merge(F take);
+
+private:
+  size_t		memory;
+  size_t		used;
+  std::vector<std::vector<std::string> >	kept;
+  std::vector<FILE *>	files;
+  std::mutex		lock;
+
+  static bool read(FILE * const file, std::string &s);
+};
+
+bool runs::add(std::vector<std::string> &strings) {
+  size_t bytes = 0;
+  for (size_t i = 0; i < strings.size(); i++) bytes += sizeof(std::string) + strings[i].size();
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (used + bytes <= memory) {
+      used += bytes;
+      kept.push_back(std::vector<std::string>());
+      kept.back().swap(strings);
+      return true;
+    }
+  }
+  FILE * const file = tmpfile();
+  if (! file) return false;
+  std::vector<unsigned char> out;
+  for (size_t i = 0; i < strings.size(); i++) {
+    put_bytes(out, strings[i].size(), 2);
+    out.insert(out.end(), strings[i].begin(), strings[i].end());
+  }
+  const bool ok = out.empty() || fwrite(&out[0], 1, out.size(), file) == out.size();
+  if (! ok || fflush(file)) {
+    fclose(file);
+    return false;
+  }
+  rewind(file);
+  strings.clear();
+  std::lock_guard<std::mutex> guard(lock);
+  files.push_back(file);
+  return true;
+}
+
+bool runs::read(FILE * const file, std::string &s) {
+  unsigned char length[2];
+  if (fread(length, 1, 2, file) != 2) return false;
+  s.resize(length[0] | length[1] << 8);
+  return s.empty() || fread(&s[0], 1, s.size(), file) == s.size();
+}
+
+template <class F>
+bool runs::merge(F take) {
+  const size_t n = kept.size() + files.size();
+  std::vector<std::string> head(n);
+  std::vector<size_t> next(kept.size(), 0);
+  // the run with the least head on the top
+  std::priority_queue<size_t, std::vector<size_t>, std::function<bool (size_t, size_t)> >
+    order([&head](const size_t a, const size_t b) { return head[b] < head[a]; });
+  std::function<bool (size_t)> advance = [&](const size_t r) {
+    if (r < kept.size()) {
+      if (next[r] == kept[r].size()) return false;
+      head[r].swap(kept[r][next[r]++]);
+      return true;
+    }
+    return read(files[r - kept.size()], head[r]);
+  };
+
+  for (size_t r = 0; r < n; r++) if (advance(r)) order.push(r);
+  std::string current;
+  while (! order.empty()) {
+    size_t r = order.top();
+    order.pop();
+    current.swap(head[r]);
+    size_t count = 1;
+    if (advance(r)) order.push(r);
+    while (! order.empty() && head[order.top()] == current) {
+      r = order.top();
+      order.pop();
+      count++;
+      if (advance(r)) order.push(r);
+    }
+    take(current, count);
+  }
+  for (size_t i = 0; i < files.size(); i++) if (ferror(files[i])) return false;
+  return true;
+}
+
+// Results of the entries of a folded key: the key, '\0', u32 bytes and u32 count
+static void put_group(std::string &out, const std::string &key, const uint32_t bytes, const uint32_t count) {
+  out = key;
+  out.push_back('\0');
+  for (int i = 0; i < 32; i += 8) out.push_back((char) ((bytes >> i) & 0xff));
+  for (int i = 0; i < 32; i += 8) out.push_back((char) ((count >> i) & 0xff));
+}
+
+static uint32_t get_u32(const std::string &s, const size_t at) {
+  const unsigned char * const p = (const unsigned char *) s.data() + at;
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// Sums of groups of the same key, sorted
+static void sum_groups(std::vector<std::string> &groups) {
+  size_t n = 0;
+  for (size_t i = 0; i < groups.size(); i++) {
+    const size_t key = groups[i].size() - 8;
+    if (n && groups[n - 1].size() == groups[i].size() && ! groups[n - 1].compare(0, key, groups[i], 0, key))
+      put_group(groups[n - 1], groups[i].substr(0, key - 1),
+                get_u32(groups[n - 1], key) + get_u32(groups[i], key), get_u32(groups[n - 1], key + 4) + get_u32(groups[i], key + 4));
+    else if (n++ != i) groups[n - 1].swap(groups[i]);
+  }
+  groups.resize(n);
+}
+
+struct input_state {
+  std::mutex		lock;
+  std::condition_variable	done;
+  size_t		in_flight;
+  size_t		entries;
+  size_t		rejected;
+  size_t		longest;	// the bytes of the longest result
+  std::vector<std::string>	examples;	// of rejected lines
+  bool			failed;
+};
+
+// Encodes the lines of a chunk into a sorted run of entries and one of their groups
+static void encode_chunk(const fsa_builder &builder, const std::string &chunk, runs &entries, runs &groups, input_state &state) {
+  std::vector<std::pair<std::string, size_t> > encoded;
+  std::vector<std::string> rejected;
+  size_t count = 0;
+  for (size_t at = 0; at < chunk.size(); ) {
+    size_t end = chunk.find('\n', at);
+    if (end == std::string::npos) end = chunk.size();
+    size_t length = end - at;
+    if (length && chunk[at + length - 1] == '\r') length--;
+    if (length) {
+      std::pair<std::string, size_t> e;
+      if (builder.encode(chunk.data() + at, length, e.first, e.second)) encoded.push_back(e);
+      else if (count++ < 10) rejected.push_back(chunk.substr(at, length));
+    }
+    at = end + 1;
+  }
+
+  std::sort(encoded.begin(), encoded.end());
+  std::vector<std::string> strings, keys;
+  std::string key, group;
+  size_t longest = 0;
+  for (size_t i = 0; i < encoded.size(); i++) {
+    if (i && encoded[i].first == encoded[i - 1].first) continue;
+    builder.fold(encoded[i].first, key);
+    put_group(group, key, encoded[i].second, 1);
+    keys.push_back(group);
+    longest = std::max(longest, encoded[i].second);
+    strings.push_back(std::string());
+    strings.back().swap(encoded[i].first);
+  }
+  std::sort(keys.begin(), keys.end());
+  sum_groups(keys);
+  const size_t n = strings.size();
+  const bool ok = entries.add(strings) && groups.add(keys);
+
+  std::lock_guard<std::mutex> guard(state.lock);
+  state.entries += n;
+  state.rejected += count;
+  state.longest = std::max(state.longest, longest);
+  for (size_t i = 0; i < rejected.size() && state.examples.size() < 10; i++) state.examples.push_back(rejected[i]);
+  state.failed |= ! ok;
+  state.in_flight--;
+  state.done.notify_all();
+}
+
+int main(const int argc, const char *argv[]) {
+  const char * output = NULL;
+  std::vector<const char *> inputs;
+  int type = 1;
+  int goto_length = 0;
+  unsigned int threads = 0;
+  size_t memory = 1024;
+
+  for (int i = 1; i < argc; i++) {
+    if (! strcmp(argv[i], "-f") && ++i < argc) output = argv[i];
+    else if (! strcmp(argv[i], "-y") && ++i < argc) type = atoi(argv[i]);
+    else if (! strcmp(argv[i], "-g") && ++i < argc) goto_length = atoi(argv[i]);
+    else if (! strcmp(argv[i], "-t") && ++i < argc) threads = atoi(argv[i]);
+    else if (! strcmp(argv[i], "-m") && ++i < argc) memory = atoi(argv[i]);
+    else if (argv[i][0] != '-' || ! argv[i][1]) inputs.push_back(argv[i]);
+    else {
+      cerr << MAJKA_VERSION << endl;
+      cerr << "Builds a dictionary of the lines key:value[:tag] of the files (- or none for the input)" << endl
+           << "-f file    dictionary file to write" << endl
+           << "-y n       type of the dictionary, 1-7 or 129-135 (default 1, w-lt)" << endl
+           << "-g n       bytes of go_to fields, 1-8 (default the least the automaton fits)" << endl
+           << "-t n       worker threads (default one per hardware thread)" << endl
+           << "-m n       MiB of sorted entries kept in memory, the rest goes to temporary files (default 1024)" << endl
+           << "-h         help" << endl;
+      return strcmp(argv[i], "-h") ? 1 : 0;
+    }
+  }
+  fsa_builder builder(type);
+  if (! output) {
+    cerr << "Missing dictionary file (-f option)" << endl;
+    return 1;
+  }
+  if (! builder.supported() || goto_length < 0 || goto_length > 8) {
+    cerr << "Unsupported type (-y option) or width of go_to fields (-g option)" << endl;
+    return 1;
+  }
+  if (inputs.empty()) inputs.push_back("-");
+
+  memory <<= 20;
+  runs entries(memory / 2), groups(memory / 2);
+  input_state state;
+  state.in_flight = state.entries = state.rejected = state.longest = 0;
+  state.failed = false;
+  pool workers(threads);
+  // chunks being encoded take memory as well, their number is bounded
+  const size_t chunk_size = std::max((size_t) 1 << 20, std::min((size_t) 64 << 20, memory / 4 / (workers.size() + 1)));
+  std::string rest;
+  std::vector<char> block(chunk_size);
+
+  for (size_t f = 0; f < inputs.size(); f++) {
+    FILE * const input = strcmp(inputs[f], "-") ? fopen(inputs[f], "rb") : stdin;
+    if (! input) {
+      cerr << "Cannot open input file " << inputs[f] << endl;
+      return 2;
+    }
+    for (;;) {
+      const size_t n = fread(&block[0], 1, block.size(), input);
+      const std::shared_ptr<std::string> chunk(new std::string);
+      chunk->swap(rest);
+      chunk->append(&block[0], n);
+      // a line is encoded by one worker, the incomplete one waits for the next block
+      const size_t end = n ? chunk->rfind('\n') : chunk->size();
+      if (end == std::string::npos) {
+        rest.swap(*chunk);
+        continue;
+      }
+      if (end < chunk->size()) rest.assign(*chunk, end + 1, std::string::npos);
+      chunk->resize(end);
+      if (! chunk->empty()) {
+        std::unique_lock<std::mutex> guard(state.lock);
+        state.done.wait(guard, [&] { return state.in_flight <= workers.size(); });
+        state.in_flight++;
+        workers.submit([&builder, chunk, &entries, &groups, &state] { encode_chunk(builder, *chunk, entries, groups, state); });
+      }
+      if (! n) break;
+    }
+    if (ferror(input)) {
+      cerr << "Cannot read input file " << inputs[f] << endl;
+      return 2;
+    }
+    if (input != stdin) fclose(input);
+  }
+  {
+    std::unique_lock<std::mutex> guard(state.lock);
+    state.done.wait(guard, [&] { return ! state.in_flight; });
+  }
+  for (size_t i = 0; i < state.examples.size(); i++) cerr << "Skipped: " << state.examples[i] << endl;
+  if (state.rejected) cerr << state.rejected << " lines skipped" << endl;
+  if (state.failed) {
+    cerr << "Cannot write temporary files" << endl;
+    return 3;
+  }
+
+  // groups of the whole input are summed while the automaton is built
+  results_limits limits;
+  limits.result = state.longest;
+  limits.count = limits.size = 0;
+  size_t compound_count = 0, compound_size = 0, compound_parts = 0;
+  bool groups_ok = false;
+  std::thread summing([&] {
+    std::string key;
+    size_t bytes = 0, count = 0;
+    groups_ok = groups.merge([&](const std::string &group, const size_t runs) {
+      const size_t at = group.size() - 8;
+      if (group.compare(0, at - 1, key)) {
+        if (! key.empty() && key[0] == '!') compound_parts = std::max(compound_parts, count);
+        if (! key.empty() && key[0] == '^') {
+          compound_size = std::max(compound_size, bytes);
+          compound_count = std::max(compound_count, count);
+        }
+        key.assign(group, 0, at - 1);
+        bytes = count = 0;
+      }
+      // the same sums in several runs come merged
+      bytes += (size_t) get_u32(group, at) * runs;
+      count += (size_t) get_u32(group, at + 4) * runs;
+      limits.size = std::max(limits.size, bytes);
+      limits.count = std::max(limits.count, count);
+    });
+    if (! key.empty() && key[0] == '!') compound_parts = std::max(compound_parts, count);
+    if (! key.empty() && key[0] == '^') {
+      compound_size = std::max(compound_size, bytes);
+      compound_count = std::max(compound_count, count);
+    }
+  });
+
+  size_t distinct = 0;
+  const bool entries_ok = entries.merge([&](const std::string &entry, size_t) {
+    builder.add(entry);
+    distinct++;
+  });
+  summing.join();
+  if (! entries_ok || ! groups_ok) {
+    cerr << "Cannot read temporary files" << endl;
+    return 3;
+  }
+  // compounds are looked up only without other results: the first parts of every
+  // split of the word in the '!' automaton, the rest in the '^' one
+  if (compound_parts && compound_size) {
+    limits.size = std::max(limits.size, max_word_length * compound_parts * compound_size);
+    limits.count = std::max(limits.count, max_word_length * compound_parts * compound_count);
+  }
+
+  if (! builder.write(output, goto_length, limits)) return 3;
+  cerr << distinct << " entries, " << builder.nodes() << " nodes, " << builder.arcs_count() << " arcs" << endl;
+  return 0;
+}
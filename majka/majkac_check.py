@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+Round-trip check of majkac (make check).
+
+Usage: ./majkac_check.py [directory of majkac and majka]
+
+Random entries are compiled by majkac into dictionaries of every type, the
+keys are looked up by majka -p and their results compared with the entries.
+Wider go_to fields are checked on some types. A larger list compiled with
+-m 1 goes to temporary files (two chunks, each over the 512 KiB of entries kept
+in memory) and must give the same dictionary as one sorted in memory, as must a
+single worker thread.
+"""
+
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+TAGGED = (1, 3, 4, 129, 131, 132)       # key:value:tag
+TAG_FIRST = (3, 131)                    # results tag:value
+TYPES = (1, 2, 3, 4, 5, 6, 7, 129, 130, 131, 132, 133, 134, 135)
+
+LETTERS = 'abcdeghijklmnoprstuvyzáčďéěíňóřšťúůýž'
+PREFIXES = ('', '', '', 'ne', 'nej', 'po', 'nejne')
+TAGS = ('k1gMnSc1', 'k1gFnPc4', 'k2eAgMnSc1d1', 'k2eNgInPc2d3', 'k5eAaImIp3nS',
+        'k6eAd1', 'k3xPyRgFnSc7', 'kA', 'k9')
+
+
+def random_stem(rng):
+    return ''.join(rng.choice(LETTERS) for _ in range(rng.randint(2, 9)))
+
+
+def random_entries(rng, count):
+    """Lists of (key, value, tag), keys sharing stems, prefixes and values."""
+    entries = []
+    while len(entries) < count:
+        stem = random_stem(rng)
+        value = stem + rng.choice(('', 'ý', 'a', 'ost'))
+        for _ in range(rng.randint(1, 4)):
+            key = rng.choice(PREFIXES) + stem + rng.choice(('', 'ého', 'ou', 'ami', 'í'))
+            entries.append((key, rng.choice((value, value, key, random_stem(rng))),
+                            rng.choice(TAGS)))
+    return entries
+
+
+def line(entry, dictionary_type):
+    key, value, tag = entry
+    if dictionary_type == 130:
+        return key
+    if dictionary_type in TAGGED:
+        return '%s:%s:%s' % (key, value, tag)
+    return '%s:%s' % (key, value)
+
+
+def expected(entries, dictionary_type):
+    """Results of every key as majka returns them, in any order."""
+    results = {}
+    for key, value, tag in entries:
+        if dictionary_type == 130:
+            result = (key,)
+        elif dictionary_type in TAG_FIRST:
+            result = (tag, value)
+        elif dictionary_type in TAGGED:
+            result = (value, tag)
+        else:
+            result = (value,)
+        results.setdefault(key, set()).add(result)
+    return results
+
+
+def build(tools, path, lines, dictionary_type, *options):
+    subprocess.run([os.path.join(tools, 'majkac'), '-f', path, '-y', str(dictionary_type)]
+                   + list(options), input=('\n'.join(lines) + '\n').encode(),
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+
+
+def lookup(tools, path, words, fields):
+    """Results of the words by majka -p, tuples of fields items each."""
+    output = subprocess.run([os.path.join(tools, 'majka'), '-p', '-f', path],
+                            input=('\n'.join(words) + '\n').encode(),
+                            stdout=subprocess.PIPE, check=True).stdout.decode()
+    found = {}
+    for word, result in zip(words, output.split('\n')):
+        items = result.split(':')[1 + word.count(':'):]
+        found[word] = set(tuple(items[i:i + fields]) for i in range(0, len(items), fields))
+    return found
+
+
+def check(tools, directory, entries, absent, dictionary_type, *options):
+    path = os.path.join(directory, 'check.%d' % dictionary_type)
+    build(tools, path, [line(e, dictionary_type) for e in entries], dictionary_type, *options)
+    results = expected(entries, dictionary_type)
+    fields = 1 if dictionary_type == 130 else 2 if dictionary_type in TAGGED else 1
+    found = lookup(tools, path, sorted(results) + absent, fields)
+    errors = ['%s: %s, expected %s' % (word, sorted(found[word]), sorted(results.get(word, ())))
+              for word in found if found[word] != results.get(word, set())]
+    print('type %3d %-6s %s' % (dictionary_type, ' '.join(options),
+                                '%d errors' % len(errors) if errors else 'ok'))
+    for error in errors[:5]:
+        print('  ' + error)
+    return not errors
+
+
+def same_builds(tools, directory, lines, *variants):
+    """Builds of type 1 with each list of options, all of the same bytes."""
+    contents = []
+    for i, options in enumerate(variants):
+        path = os.path.join(directory, 'same.%d' % i)
+        build(tools, path, lines, 1, *options)
+        with open(path, 'rb') as f:
+            contents.append(f.read())
+    same = all(c == contents[0] for c in contents)
+    print('type   1 %s %s' % (' / '.join(' '.join(o) or 'default' for o in variants),
+                              'same' if same else 'DIFFERENT'))
+    return same
+
+
+def main(argv):
+    tools = argv[1] if len(argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    rng = random.Random(42)
+    entries = random_entries(rng, 3000)
+    keys = set(e[0] for e in entries)
+    absent = [w for w in (random_stem(rng) + 'x' for _ in range(200)) if w not in keys]
+    ok = True
+
+    with tempfile.TemporaryDirectory() as directory:
+        for dictionary_type in TYPES:
+            ok &= check(tools, directory, entries, absent, dictionary_type)
+        for dictionary_type in (1, 130, 135):
+            for width in ('3', '8'):
+                ok &= check(tools, directory, entries, absent, dictionary_type, '-g', width)
+        # duplicates across the runs are merged
+        large = random_entries(rng, 45000)
+        lines = [line(e, 1) for e in large + large[:1000]]
+        ok &= same_builds(tools, directory, lines, (), ('-m', '1'), ('-t', '1'))
+        ok &= check(tools, directory, large, absent, 1, '-m', '1')
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,389 @@
+/* Lookup daemon: keeps dictionaries resident and serves lookups over a UNIX domain socket */
+
+#include	<iostream>
+#include	<string.h>
+#include	<stdlib.h>
+#include	<errno.h>
+#include	<limits.h>
+#include	<signal.h>
+#include	<unistd.h>
+#include	<sys/epoll.h>
+#include	<sys/eventfd.h>
+#include	<sys/socket.h>
+#include	<sys/un.h>
+#include	<map>
+#include	<memory>
+#include	<mutex>
+#include	<string>
+#include	<vector>
+#include	"majka.h"
+#include	"majka_pool.h"
+#include	"majka_protocol.h"
+
+struct dictionary {
+  std::string		file;
+  fsa *			majka;
+};
+
+// A client connection, shared with the workers answering its requests. Only the
+// epoll thread touches the socket, workers append responses to out.
+struct connection {
+  int			fd;
+  std::string		in;		// received, not a complete frame yet
+  std::string		out;		// responses not written yet
+  std::mutex		lock;		// of out, closed and in_flight
+  bool			closed;
+  bool			writing;	// EPOLLOUT is watched
+  bool			finished;	// the client sends no more requests (EOF)
+  size_t		in_flight;	// requests taken, not answered yet
+};
+typedef std::shared_ptr<connection>	connection_ptr;
+
+struct request {
+  connection_ptr	client;
+  uint32_t		id;
+  char			flags;
+  const dictionary *	dict;
+  std::string		words;		// NUL terminated
+  std::vector<size_t>	word_at;
+};
+typedef std::vector<request>		batch;
+
+static std::vector<dictionary>			dictionaries;
+static std::map<std::string, const dictionary *>	names;
+static std::map<int, connection_ptr>		connections;
+static int					epoll_fd, wake_fd;
+static volatile sig_atomic_t			stopping = 0;
+
+// connections with responses to write, filled by the workers
+static std::vector<connection_ptr>		ready;
+static std::mutex				ready_lock;
+
+static void wake(void) {
+  const uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0) {}	// the counter is full, the loop wakes anyway
+}
+
+static void stop(int) {
+  stopping = 1;
+  wake();
+}
+
+static void watch(connection &c, const bool writing) {
+  epoll_event event;
+  event.events = (c.finished ? 0 : (uint32_t) EPOLLIN) | (writing ? (uint32_t) EPOLLOUT : 0);
+  event.data.fd = c.fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &event);
+  c.writing = writing;
+}
+
+static void drop(const connection_ptr &c) {
+  {
+    std::lock_guard<std::mutex> guard(c->lock);
+    c->closed = true;
+    c->out.clear();
+  }
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  connections.erase(c->fd);
+}
+
+// Writes as much as the socket takes, the rest once it is writable again.
+// Returns false if the connection failed or a finished one has nothing more to write.
+static bool flush(connection &c) {
+  std::lock_guard<std::mutex> guard(c.lock);
+  size_t written = 0;
+  while (written < c.out.size()) {
+    const ssize_t n = send(c.fd, c.out.data() + written, c.out.size() - written, MSG_NOSIGNAL);
+    if (n > 0) written += n;
+    else if (n < 0 && errno == EINTR) continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    else return false;
+  }
+  c.out.erase(0, written);
+  if (c.out.empty() == c.writing) watch(c, ! c.out.empty());
+  return ! (c.finished && c.out.empty() && ! c.in_flight);
+}
+
+// answered: the response is of a request taken for the workers
+static void respond(const connection_ptr &c, const std::string &response, const bool answered = false) {
+  std::lock_guard<std::mutex> guard(c->lock);
+  if (! c->closed) c->out.append(response);
+  if (answered) c->in_flight--;
+}
+
+static std::string status_response(const uint32_t id, const majkad_status status) {
+  std::string response;
+  put_u32(response, 9);
+  put_u32(response, id);
+  response.push_back((char) status);
+  put_u32(response, 0);
+  return response;
+}
+
+// Runs the lookups of a batch of requests, on a worker thread
+static void answer(const batch &requests) {
+  static thread_local std::vector<char> scratch;
+
+  for (size_t r = 0; r < requests.size(); r++) {
+    const request &q = requests[r];
+    fsa * const majka = q.dict->majka;
+    std::string response;
+    if (scratch.size() < majka->max_results_size) scratch.resize(majka->max_results_size);
+
+    put_u32(response, 0);	// the size, once known
+    put_u32(response, q.id);
+    response.push_back((char) majkad_ok);
+    put_u32(response, q.word_at.size());
+    for (size_t w = 0; w < q.word_at.size(); w++) {
+      const int rc = majka->find(q.words.data() + q.word_at[w], scratch.data(), q.flags);
+      const char * end = scratch.data();
+      for (int i = 0; i < rc; i++) end += strlen(end) + 1;
+      put_u16(response, rc);
+      put_u32(response, end - scratch.data());
+      response.append(scratch.data(), end - scratch.data());
+    }
+    std::string header;
+    put_u32(header, response.size() - 4);
+    response.replace(0, 4, header);
+    respond(q.client, response, true);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(ready_lock);
+    for (size_t r = 0; r < requests.size(); r++) ready.push_back(requests[r].client);
+  }
+  wake();
+}
+
+// Parses a request frame, requests needing no lookup are answered at once
+static void parse(const connection_ptr &c, const char * const data, const size_t size, batch &pending) {
+  frame_reader frame(data, size);
+  request q;
+  uint8_t flags, name_length;
+  const char * name, * word;
+  uint32_t count;
+  uint16_t length;
+
+  q.client = c;
+  if (! frame.u32(q.id) || ! frame.u8(flags) || ! frame.u8(name_length)
+      || ! frame.bytes(name, name_length) || ! frame.u32(count)) {
+    respond(c, status_response(0, majkad_malformed));
+    return;
+  }
+  q.flags = flags;
+  if (! name_length) q.dict = &dictionaries[0];
+  else {
+    std::map<std::string, const dictionary *>::const_iterator found = names.find(std::string(name, name_length));
+    if (found == names.end()) {
+      respond(c, status_response(q.id, majkad_unknown_dictionary));
+      return;
+    }
+    q.dict = found->second;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (! frame.u16(length) || ! frame.bytes(word, length)) break;
+    q.word_at.push_back(q.words.size());
+    q.words.append(word, length).push_back('\0');
+  }
+  if (q.word_at.size() != count || ! frame.done()) respond(c, status_response(q.id, majkad_malformed));
+  else if (! count) respond(c, status_response(q.id, majkad_ok));
+  else {
+    std::lock_guard<std::mutex> guard(c->lock);
+    c->in_flight++;
+    pending.push_back(q);
+  }
+}
+
+// Reads what is available, returns false if the connection is to be dropped.
+// A client may shut its side down after its requests, they are answered first.
+static bool receive(const connection_ptr &c, batch &pending) {
+  char buffer[65536];
+  for (;;) {
+    const ssize_t n = read(c->fd, buffer, sizeof(buffer));
+    if (n > 0) c->in.append(buffer, n);
+    else if (n < 0 && errno == EINTR) continue;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    else if (n == 0) {
+      c->finished = true;
+      watch(*c, c->writing);	// EOF is not reported again
+      break;
+    }
+    else return false;
+  }
+
+  size_t at = 0;
+  while (c->in.size() - at >= 4) {
+    const uint32_t size = get_u32(c->in.data() + at);
+    if (size > majkad_max_frame) return false;
+    if (c->in.size() - at - 4 < size) break;
+    parse(c, c->in.data() + at + 4, size, pending);
+    at += 4 + size;
+  }
+  c->in.erase(0, at);
+  return flush(*c);
+}
+
+// Requests received by one round of the loop, from all connections, are
+// coalesced into batches of about batch_words words for the workers
+static void dispatch(pool &workers, batch &pending, const size_t batch_words) {
+  size_t words = 0;
+  std::shared_ptr<batch> current(new batch());
+  for (size_t i = 0; i < pending.size(); i++) {
+    words += pending[i].word_at.size();
+    current->push_back(pending[i]);
+    if (words >= batch_words || i + 1 == pending.size()) {
+      workers.submit([current]() { answer(*current); });
+      current.reset(new batch());
+      words = 0;
+    }
+  }
+  pending.clear();
+}
+
+static void accept_all(const int listen_fd) {
+  for (;;) {
+    const int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    connection_ptr c(new connection());
+    c->fd = fd;
+    c->closed = c->writing = c->finished = false;
+    c->in_flight = 0;
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) close(fd);
+    else connections[fd] = c;
+  }
+}
+
+static void flush_ready(void) {
+  std::vector<connection_ptr> written;
+  {
+    std::lock_guard<std::mutex> guard(ready_lock);
+    written.swap(ready);
+  }
+  for (size_t i = 0; i < written.size(); i++) {
+    const connection_ptr &c = written[i];
+    if (! c->closed && ! flush(*c)) drop(c);
+  }
+}
+
+static int listen_on(const char * const path) {
+  sockaddr_un address;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    cerr << "Socket path too long: " << path << endl;
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(path);	// left by a previous run
+  if (fd < 0 || bind(fd, (sockaddr *) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+    cerr << "Cannot listen on " << path << ": " << strerror(errno) << endl;
+    return -1;
+  }
+  return fd;
+}
+
+int main(const int argc, const char *argv[]) {
+  const char * socket_path = NULL;
+  std::vector<const char *> files;
+  unsigned int threads = 0;
+  int residency = RESIDENT_PREFAULT;
+  size_t batch_words = 256;
+
+  for (int i = 1; i < argc; i++) {
+    if (! strcmp(argv[i], "-s") && ++i < argc) socket_path = argv[i];
+    else if (! strcmp(argv[i], "-f") && ++i < argc) files.push_back(argv[i]);
+    else if (! strcmp(argv[i], "-t") && ++i < argc) threads = atoi(argv[i]);
+    else if (! strcmp(argv[i], "-r") && ++i < argc) residency = atoi(argv[i]);
+    else if (! strcmp(argv[i], "-b") && ++i < argc) batch_words = atoi(argv[i]);
+    else {
+      cerr << MAJKA_VERSION << endl;
+      cerr << "-s socket  path of the UNIX domain socket to listen on" << endl
+           << "-f file    dictionary file, may be repeated (the first one is the default)" << endl
+           << "-t n       worker threads (default one per hardware thread)" << endl
+           << "-r n       RESIDENT_* options of the dictionaries (default 4, prefault)" << endl
+           << "-b n       words of coalesced requests per batch (default 256)" << endl
+           << "-h         help" << endl;
+      return strcmp(argv[i], "-h") ? 1 : 0;
+    }
+  }
+  if (! socket_path || files.empty()) {
+    cerr << "Missing socket path (-s option) or dictionary file (-f option)" << endl;
+    return 1;
+  }
+
+  dictionaries.reserve(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    dictionary d;
+    d.file = files[i];
+    d.majka = new fsa(files[i], residency);
+    if (d.majka->state) {
+      cerr << "Cannot load " << files[i] << endl;
+      return d.majka->state;
+    }
+    dictionaries.push_back(d);
+    // clients ask by the path as given or resolved
+    char real[PATH_MAX];
+    names[files[i]] = &dictionaries.back();
+    if (realpath(files[i], real)) names[real] = &dictionaries.back();
+  }
+
+  const int listen_fd = listen_on(socket_path);
+  if (listen_fd < 0) return 1;
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+  event.data.fd = wake_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  pool * const workers = new pool(threads);
+  epoll_event events[64];
+  batch pending;
+  while (! stopping) {
+    const int n = epoll_wait(epoll_fd, events, 64, -1);
+    if (n < 0 && errno != EINTR) break;
+    for (int i = 0; i < n; i++) {
+      const int fd = events[i].data.fd;
+      if (fd == listen_fd) accept_all(listen_fd);
+      else if (fd == wake_fd) {
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0) {}
+        flush_ready();
+      }
+      else {
+        std::map<int, connection_ptr>::iterator found = connections.find(fd);
+        if (found == connections.end()) continue;
+        const connection_ptr c = found->second;
+        // a finished client which closed the connection entirely takes no responses
+        if (events[i].events & EPOLLERR || (c->finished && events[i].events & EPOLLHUP)) drop(c);
+        else if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+          if (! receive(c, pending)) drop(c);
+        }
+        else if (events[i].events & EPOLLOUT && ! flush(*c)) drop(c);
+      }
+    }
+    if (! pending.empty()) dispatch(*workers, pending, batch_words);
+  }
+
+  delete workers;	// answers the requests taken
+  close(listen_fd);
+  unlink(socket_path);
+  for (size_t i = 0; i < dictionaries.size(); i++) delete dictionaries[i].majka;
+  return 0;
+}
@@ -0,0 +1,79 @@
+/* Copyright, under GPL 2.0 2016 <petr.pulc@wolterskluwer.com> */
+
+/* C API of the majka module for other extensions
+ *
+ * Usage:
+ *
+ *   #include "majka_capi.h"
+ *
+ *   if (Majka_IMPORT == NULL) return NULL;  // in the module init function
+ *
+ *   majka_dictionary* dict = Majka_API->acquire(morph);  // with the GIL
+ *   char* buffer = malloc(Majka_API->buffer_size(dict));
+ *   Py_BEGIN_ALLOW_THREADS
+ *   int count = Majka_API->find(dict, word, buffer, flags);
+ *   for (const char* r = buffer; count--; r = Majka_API->next_result(r)) {
+ *     size_t lemma_len;
+ *     const char* tag = Majka_API->split_result(r, &lemma_len);
+ *     ...
+ *   }
+ *   Py_END_ALLOW_THREADS
+ *   Majka_API->release(dict);  // with the GIL
+ *
+ * Fields are only ever appended to Majka_CAPI, check version for the newer ones.
+ */
+
+#ifndef MAJKA_CAPI_H
+#define MAJKA_CAPI_H
+
+#include <Python.h>
+
+#define MAJKA_CAPI_VERSION 1
+#define MAJKA_CAPI_NAME "majka._C_API"
+
+#ifdef __cplusplus
+class fsa;
+typedef fsa majka_fsa;  /* see majka/majka.h */
+extern "C" {
+#else
+typedef struct majka_fsa majka_fsa;
+#endif
+
+/* A loaded automaton, kept alive between acquire and release */
+typedef struct majka_dictionary majka_dictionary;
+
+typedef struct {
+  int version;
+
+  /* Automaton of a Majka object, NULL with an exception set if it is not one.
+   * Needs the GIL, as does release. */
+  majka_dictionary* (*acquire)(PyObject* majka);
+  void (*release)(majka_dictionary* dict);
+  /* Current flags of a Majka object, -1 with an exception set on error (GIL) */
+  int (*get_flags)(PyObject* majka);
+
+  /* The rest does not need the GIL and is reentrant */
+
+  /* The fsa engine object itself, for C++ callers of fsa::find */
+  majka_fsa* (*get_fsa)(majka_dictionary* dict);
+  /* Size of the buffer find needs */
+  size_t (*buffer_size)(majka_dictionary* dict);
+  /* Writes NUL separated "lemma:tag" results (UTF-8) into buffer, returns their count */
+  int (*find)(majka_dictionary* dict, const char* word, char* buffer, int flags);
+  /* Result following the given one */
+  const char* (*next_result)(const char* result);
+  /* Tag of the result, *lemma_len is set to the length of the lemma */
+  const char* (*split_result)(const char* result, size_t* lemma_len);
+} Majka_CAPI;
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef MAJKA_MODULE
+static Majka_CAPI* Majka_API = NULL;
+#define Majka_IMPORT \
+  (Majka_API = (Majka_CAPI*) PyCapsule_Import(MAJKA_CAPI_NAME, 0))
+#endif
+
+#endif
@@ -4,25 +4,493 @@
 #include <structmember.h>
 #include <string.h>
 #include <iostream>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "majka/majka.h"
+#include "majka/majka_client.h"
+#include "majka/majka_overlay.h"
+#include "majka/majka_pool.h"
+#include "majka/majka_tags.h"
+#define MAJKA_MODULE
+#include "majka_capi.h"
 
 #if PY_MAJOR_VERSION >= 3
   #define PY3K
 #endif
 
+#if PY_VERSION_HEX >= 0x03070000
+  #define MAJKA_FASTCALL
+#endif
+
+/* Loaded dictionaries
+ *
+ * An automaton is shared by all Majka objects of the process opened from the
+ * same, unchanged file. This way unpickled objects attach to the automaton
+ * already mapped instead of loading it again. One loaded with fewer residency
+ * options than requested is not reused.
+ */
+
+struct dictionary {
+  fsa* majka;
+  int refs;
+  std::string path;  // canonical
+  long long size;
+  long long mtime;
+  long long inode;  // a new build renamed over the file has a new one
+  int residency;    // requested RESIDENT_* options
+};
+
+static std::map<std::string, dictionary*> dictionaries;
+
+static int file_identity(const char* file, std::string* path, long long* size,
+                         long long* mtime, long long* inode) {
+  struct stat st;
+
+  if (stat(file, &st) < 0) return -1;
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  *inode = st.st_ino;
+#if defined(__unix__) || defined(__APPLE__)
+  char* real = realpath(file, NULL);
+  if (real) {
+    *path = real;
+    free(real);
+    return 0;
+  }
+#endif
+  *path = file;
+  return 0;
+}
+
+// Called with the GIL held; returns NULL if the file cannot be loaded
+static dictionary* dictionary_open(const char* file, int residency) {
+  std::string path;
+  long long size, mtime, inode;
+  dictionary* dict;
+  fsa* majka;
+
+  if (file_identity(file, &path, &size, &mtime, &inode) < 0) return NULL;
+
+  std::map<std::string, dictionary*>::iterator it = dictionaries.find(path);
+  if (it != dictionaries.end() && it->second->size == size &&
+      it->second->mtime == mtime && it->second->inode == inode &&
+      !(residency & ~it->second->residency)) {
+    it->second->refs++;
+    return it->second;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  majka = new fsa(file, residency);
+  Py_END_ALLOW_THREADS
+  if (majka->state) {
+    delete majka;
+    return NULL;
+  }
+
+  dict = new dictionary();
+  dict->majka = majka;
+  dict->refs = 1;
+  dict->path = path;
+  dict->size = size;
+  dict->mtime = mtime;
+  dict->inode = inode;
+  dict->residency = residency;
+  // a changed file replaces the stale entry, its users keep the old automaton
+  dictionaries[path] = dict;
+  return dict;
+}
+
+static void dictionary_close(dictionary* dict) {
+  if (--dict->refs) return;
+  std::map<std::string, dictionary*>::iterator it = dictionaries.find(dict->path);
+  if (it != dictionaries.end() && it->second == dict) dictionaries.erase(it);
+  delete dict->majka;
+  delete dict;
+}
+
+/* Tag decoding
+ *
+ * Compact tags are decoded into dicts by a tagset compiled from a small
+ * definition, one line per value of an attribute:
+ *
+ *   attribute letter[/condition] key value
+ *
+ * Consecutive lines of the same attribute make a slot; slots are tried in the
+ * order of the definition, the pair of a tag is decoded by the first slot of
+ * its attribute from the current one on (an attribute may have several slots
+ * then). The letter * stands for any letter without lines of its own, the
+ * condition (e.g. /k1) restricts the line to tags where an earlier pair had
+ * that value. The value is true, false, int (the letter as a number) or any
+ * other string; values of keys ending with [] are collected in a list. Pairs
+ * left after the last slot are returned as a string under 'other'.
+ *
+ * Keys and values are Python objects created once, when the tagset is
+ * compiled, decoding only looks them up in tables.
+ */
+
+static const char default_tagset_definition[] =
+  "# Czech and Slovak tags (new tagset reference)\n"
+  "k 1 pos substantive\nk 2 pos adjective\nk 3 pos pronomina\nk 4 pos numeral\n"
+  "k 5 pos verb\nk 6 pos adverb\nk 7 pos preposition\nk 8 pos conjuction\n"
+  "k 9 pos particle\nk 0 pos interjection\nk I pos punctuation\n"
+  "e A negation false\ne N negation true\n"
+  "a P aspect perfect\na I aspect imperfect\n"
+  "m F mode infinitive\nm I mode present indicative\nm R mode imperative\n"
+  "m A mode active participle\nm N mode passive participle\n"
+  "m S mode adverbium participle, present\nm D mode adverbium participle, past\n"
+  "m B mode future indicative\n"
+  "p * person int\n"
+  "g M gender masculine\ng M animate true\ng I gender masculine\ng I animate false\n"
+  "g F gender feminine\ng N gender neuter\n"
+  "n S singular true\nn P plural true\n"
+  "c * case int\n"
+  "p * person int\n"
+  "d * degree int\n"
+  "x P/k1 type[] half\nx F/k1 type[] family surname\n"
+  "x P/k3 type[] personal\nx O/k3 type[] possessive\nx D/k3 type[] demonstrative\n"
+  "x T/k3 type[] deliminative\n"
+  "x C/k4 type[] cardinal\nx O/k4 type[] ordinal\nx R/k4 type[] reproductive\n"
+  "x D/k6 type[] demonstrative\nx T/k6 type[] delimitative\n"
+  "x C/k8 type[] coordinate\nx S/k8 type[] subordinate\n"
+  "x ./kI type[] stop\nx ,/kI type[] semi-stop\nx \"/kI type[] parenthesis\n"
+  "x (/kI type[] opening\nx )/kI type[] closing\nx ~/kI type[] other\n"
+  "y F type[] reflective\ny Q type[] interrogative\ny R type[] relative\n"
+  "y N type[] negative\ny I type[] indeterminate\n"
+  "t S type[] status\nt D type[] modal\nt T type[] time\nt A type[] respect\n"
+  "t C type[] reason\nt L type[] place\nt M type[] manner\nt Q type[] extent\n"
+  "z S subclass -s enclictic\nz Y subclass conditional\nz A subclass abbreviation\n"
+  "w B style poeticism\nw H style conversational\nw N style dialectal\n"
+  "w R style rare\nw Z style obsolete\n"
+  "~ * frequency int\n";
+
+static const int max_tagset_lists = 8;
+
+struct tagset_action {
+  unsigned char letter;                      // 0 for any
+  unsigned char cond_attribute, cond_value;  // 0 unless restricted
+  PyObject* key;
+  int list;                                  // of listed keys, -1 to set the key
+  PyObject* value;                           // NULL for the int of the letter
+};
+
+struct tagset_slot {
+  unsigned char attribute;
+  std::vector<tagset_action> actions;        // by letter, those of any letter last
+  unsigned short from[128], to[128];         // actions of each letter
+};
+
+class tagset {
+ public:
+  tagset() : ints(), key_other(NULL) {}
+  ~tagset();
+
+  // Returns false with a Python exception set if the definition is invalid
+  bool compile(const char* definition);
+  PyObject* decode(const char* tag) const;
+
+  // Attribute whose letters set the (not listed) key, 0 if none or several do
+  unsigned char attribute_of(PyObject* key) const;
+  // Appends the letters decoded to the value of the key, returns their count,
+  // -1 with a Python exception set on error
+  int letters_of(PyObject* key, PyObject* value, std::string* letters) const;
+
+ private:
+  std::vector<tagset_slot> slots;
+  std::vector<PyObject*> lists;    // keys of listed values
+  std::vector<PyObject*> objects;  // references held
+  PyObject* ints[128];             // int values of digit letters
+  PyObject* key_other;
+
+  PyObject* hold(PyObject* obj) {
+    if (obj) objects.push_back(obj);
+    return obj;
+  }
+  bool add(int line, const std::string& letter, const std::string& key,
+           const std::string& value);
+  static void index(tagset_slot* slot);
+};
+
+tagset::~tagset() {
+  for (size_t i = 0; i < objects.size(); i++) Py_DECREF(objects[i]);
+}
+
+bool tagset::compile(const char* definition) {
+  const char* line, * end, * p;
+  int number = 0;
+
+  if (!hold(key_other = PyUnicode_InternFromString("other"))) return false;
+  for (int c = '0'; c <= '9'; c++) {
+    if (!hold(ints[c] = PyLong_FromLong(c - '0'))) return false;
+  }
+
+  for (line = definition; *line; line = *end ? end + 1 : end) {
+    std::string attribute, letter, key, value;
+    std::string* fields[] = {&attribute, &letter, &key};
+
+    number++;
+    if (!(end = strchr(line, '\n'))) end = line + strlen(line);
+    for (p = line; p < end && isspace((unsigned char) *p); p++) {}
+    if (p == end || *p == '#') continue;
+    for (int f = 0; f < 3; f++) {
+      while (p < end && !isspace((unsigned char) *p)) fields[f]->push_back(*p++);
+      while (p < end && isspace((unsigned char) *p)) p++;
+    }
+    value.assign(p, end);
+    while (!value.empty() && isspace((unsigned char) value[value.size() - 1])) {
+      value.erase(value.size() - 1);
+    }
+    if (attribute.size() != 1 || (attribute[0] & 0x80) || key.empty() || value.empty()) {
+      PyErr_Format(PyExc_ValueError, "Invalid tagset definition, line %d", number);
+      return false;
+    }
+    if (slots.empty() || slots.back().attribute != attribute[0]) {
+      if (!slots.empty()) index(&slots.back());
+      slots.push_back(tagset_slot());
+      slots.back().attribute = attribute[0];
+    }
+    if (!add(number, letter, key, value)) return false;
+  }
+  if (!slots.empty()) index(&slots.back());
+  return true;
+}
+
+bool tagset::add(int line, const std::string& letter, const std::string& key,
+                 const std::string& value) {
+  std::string name = key;
+  tagset_action a;
+
+  // a letter, possibly with a condition, e.g. P/k1
+  bool ascii = true;
+  for (size_t i = 0; i < letter.size(); i++) ascii = ascii && !(letter[i] & 0x80);
+  if (!ascii || (letter.size() != 1 && (letter.size() != 4 || letter[1] != '/'))) {
+    PyErr_Format(PyExc_ValueError, "Invalid letter in tagset definition, line %d", line);
+    return false;
+  }
+  a.letter = letter[0] == '*' ? 0 : letter[0];
+  a.cond_attribute = letter.size() == 4 ? letter[2] : 0;
+  a.cond_value = letter.size() == 4 ? letter[3] : 0;
+
+  a.list = -1;
+  if (name.size() > 2 && !name.compare(name.size() - 2, 2, "[]")) {
+    name.erase(name.size() - 2);
+    for (a.list = 0; a.list < (int) lists.size(); a.list++) {
+      if (!PyUnicode_CompareWithASCIIString(lists[a.list], name.c_str())) break;
+    }
+    if (a.list == max_tagset_lists) {
+      PyErr_Format(PyExc_ValueError, "Too many listed keys in tagset definition, line %d",
+                   line);
+      return false;
+    }
+    if (a.list == (int) lists.size()) {
+      if (!hold(a.key = PyUnicode_InternFromString(name.c_str()))) return false;
+      lists.push_back(a.key);
+    }
+    a.key = lists[a.list];
+  } else if (!hold(a.key = PyUnicode_InternFromString(name.c_str()))) {
+    return false;
+  }
+
+  if (value == "true") {
+    a.value = Py_True;
+  } else if (value == "false") {
+    a.value = Py_False;
+  } else if (value == "int") {
+    if (a.letter && !isdigit(a.letter)) {
+      PyErr_Format(PyExc_ValueError, "int value of a letter which is not a digit, line %d",
+                   line);
+      return false;
+    }
+    a.value = NULL;
+  } else if (!hold(a.value = PyUnicode_FromStringAndSize(value.data(), value.size()))) {
+    return false;
+  }
+  slots.back().actions.push_back(a);
+  return true;
+}
+
+static bool tagset_action_before(const tagset_action& a, const tagset_action& b) {
+  return (a.letter ? a.letter : 128) < (b.letter ? b.letter : 128);
+}
+
+// Sorts the actions of the slot by letter, those of any letter apply to the others
+void tagset::index(tagset_slot* slot) {
+  std::vector<tagset_action>& actions = slot->actions;
+  unsigned short any, i;
+  int c;
+
+  std::stable_sort(actions.begin(), actions.end(), tagset_action_before);
+  for (any = 0; any < actions.size() && actions[any].letter; any++) {}
+  for (c = 0; c < 128; c++) {
+    slot->from[c] = any;
+    slot->to[c] = actions.size();
+  }
+  for (i = 0; i < any; i = slot->to[c]) {
+    c = actions[i].letter;
+    slot->from[c] = slot->to[c] = i;
+    while (slot->to[c] < any && actions[slot->to[c]].letter == c) slot->to[c]++;
+  }
+}
+
+PyObject* tagset::decode(const char* tag_string) const {
+  const unsigned char* tag = reinterpret_cast<const unsigned char*>(tag_string);
+  PyObject* tags = PyDict_New(), * listed[max_tagset_lists] = {NULL}, * value;
+  unsigned char seen[128] = {0};  // value letters of the attributes so far
+  size_t l;
+  bool ok = tags != NULL;
+
+  for (size_t s = 0; ok && s < slots.size(); s++) {
+    const tagset_slot& slot = slots[s];
+    if (tag[0] != slot.attribute || !tag[1]) continue;
+    seen[slot.attribute] = tag[1];
+    for (int i = tag[1] < 128 ? slot.from[tag[1]] : 0;
+         ok && i < (tag[1] < 128 ? slot.to[tag[1]] : 0); i++) {
+      const tagset_action& a = slot.actions[i];
+      if (a.cond_attribute && seen[a.cond_attribute] != a.cond_value) continue;
+      if (!(value = a.value ? a.value : ints[tag[1]])) continue;
+      if (a.list < 0) {
+        ok = PyDict_SetItem(tags, a.key, value) == 0;
+      } else {
+        ok = (listed[a.list] || (listed[a.list] = PyList_New(0))) &&
+             PyList_Append(listed[a.list], value) == 0;
+      }
+    }
+    tag += 2;
+  }
+
+  for (l = 0; l < lists.size(); l++) {
+    if (listed[l]) {
+      ok = ok && PyDict_SetItem(tags, lists[l], listed[l]) == 0;
+      Py_DECREF(listed[l]);
+    }
+  }
+  if (ok && *tag) {
+    if ((value = PyUnicode_FromString(reinterpret_cast<const char*>(tag)))) {
+      ok = PyDict_SetItem(tags, key_other, value) == 0;
+      Py_DECREF(value);
+    } else {
+      ok = false;
+    }
+  }
+  if (!ok) Py_CLEAR(tags);
+  return tags;
+}
+
+static bool same_key(PyObject* a, PyObject* b) {
+  return a == b || !PyUnicode_Compare(a, b);
+}
+
+unsigned char tagset::attribute_of(PyObject* key) const {
+  unsigned char attribute = 0;
+
+  for (size_t s = 0; s < slots.size(); s++) {
+    for (size_t i = 0; i < slots[s].actions.size(); i++) {
+      const tagset_action& a = slots[s].actions[i];
+      if (a.list >= 0 || !same_key(a.key, key)) continue;
+      if (attribute && attribute != slots[s].attribute) return 0;
+      attribute = slots[s].attribute;
+    }
+  }
+  return attribute;
+}
+
+/* Booleans are matched by True and False, also 1 and 0. False matches the
+ * tags which do not decode to True: those with other letters of the attribute
+ * and those without it ('-', see tag_filter::restrict).
+ */
+int tagset::letters_of(PyObject* key, PyObject* value, std::string* letters) const {
+  long number = PyLong_Check(value) ? PyLong_AsLong(value) : -1;
+  bool truth = PyBool_Check(value) || (PyLong_Check(value) && (number == 0 || number == 1));
+  bool digit = PyLong_Check(value) && !PyBool_Check(value) && number >= 0 && number <= 9;
+  size_t before = letters->size();
+  std::string true_letters;
+
+  if (number == -1 && PyErr_Occurred()) return -1;
+  for (size_t s = 0; s < slots.size(); s++) {
+    for (size_t i = 0; i < slots[s].actions.size(); i++) {
+      const tagset_action& a = slots[s].actions[i];
+      if (a.list >= 0 || !same_key(a.key, key)) continue;
+      if (!a.value) {
+        if (digit && (!a.letter || a.letter == '0' + number)) letters->push_back('0' + number);
+      } else if (a.value == Py_True || a.value == Py_False) {
+        if (a.value == Py_True && a.letter) true_letters.push_back(a.letter);
+        if (truth && a.letter && (number != 0) == (a.value == Py_True)) {
+          letters->push_back(a.letter);
+        }
+      } else if (a.letter && PyUnicode_Check(value) && !PyUnicode_Compare(a.value, value)) {
+        letters->push_back(a.letter);
+      }
+    }
+  }
+
+  if (truth && number == 0 && !true_letters.empty()) {
+    unsigned char attribute = attribute_of(key);
+    for (size_t s = 0; s < slots.size(); s++) {
+      if (slots[s].attribute != attribute) continue;
+      for (size_t i = 0; i < slots[s].actions.size(); i++) {
+        unsigned char letter = slots[s].actions[i].letter;
+        if (letter && true_letters.find(letter) == std::string::npos) {
+          letters->push_back(letter);
+        }
+      }
+    }
+    letters->push_back('-');
+  }
+  return PyErr_Occurred() ? -1 : letters->size() - before;
+}
+
+static tagset* default_tagset = NULL;
+
 typedef struct {
   PyObject_HEAD
+  dictionary* dict;
   fsa* majka;
+  PyObject* path;
   int flags;
   bool tags;
   bool compact_tag;
+  bool packed_tag;
   bool first_only;
+  int best;                 // results returned, by rank, 0 for all
+  PyObject* scores;         // ranking table as set, None for frequency
+  float* score_table;       // weights of attribute-value pairs of scores
   PyObject* negative;
+  PyObject* negative_utf8;  // negative encoded once, when it is set
+  tagset* decoder;          // of the tagset loaded, NULL for the default one
+  PyObject* tagset_path;    // None for the default tagset
+  char* scratch;            // results buffer reused by find
+  bool scratch_busy;
+  overlay* extra;           // words added at runtime
+  bool overlay_override;
+  int residency;            // requested, kept on reload
+  daemon_client* remote;    // lookups served by majkad instead of dict
 } Majka;
 
+// Tagset of the results of the object, also naming the keys of its filters
+static const tagset* tagset_of(const Majka* self) {
+  return self->decoder ? self->decoder : default_tagset;
+}
+
 static void Majka_dealloc(Majka* self) {
-  delete self->majka;
-  Py_DECREF(self->negative);
+  if (self->dict) dictionary_close(self->dict);
+  Py_XDECREF(self->path);
+  Py_XDECREF(self->negative);
+  Py_XDECREF(self->negative_utf8);
+  Py_XDECREF(self->scores);
+  delete [] self->score_table;
+  delete self->decoder;
+  Py_XDECREF(self->tagset_path);
+  delete [] self->scratch;
+  delete self->extra;
+  delete self->remote;
   Py_TYPE(self)->tp_free(reinterpret_cast<Majka*>(self));
 }
 
@@ -31,19 +499,90 @@ static PyObject* Majka_new(PyTypeObject* type,
                            PyObject* kwds) {
   Majka* self;
   self = reinterpret_cast<Majka*>(type->tp_alloc(type, 0));
+  self->dict = NULL;
+  self->majka = NULL;
+  self->path = NULL;
   self->flags = 0;
   self->tags = true;
   self->compact_tag = false;
+  self->packed_tag = false;
   self->first_only = false;
+  self->best = 0;
+  self->scores = Py_None;
+  Py_INCREF(Py_None);
+  self->score_table = NULL;
+  self->decoder = NULL;
+  self->tagset_path = Py_None;
+  Py_INCREF(Py_None);
   self->negative = PyUnicode_FromString("-");
+  self->negative_utf8 = PyBytes_FromString("-");
+  self->scratch = NULL;
+  self->scratch_busy = false;
+  self->extra = new overlay();
+  self->overlay_override = false;
+  self->residency = 0;
+  self->remote = NULL;
   return reinterpret_cast<PyObject*>(self);
 }
 
+/* Attaches the object to the dictionary of the file, returns -1 with an
+ * exception set on error. The scratch buffer is replaced to fit the new
+ * automaton; a find still converting results from the old one frees it.
+ */
+static int Majka_open(Majka* self, const char* file) {
+  dictionary* dict = dictionary_open(file, self->residency);
+
+  if (!dict) {
+      PyErr_SetString(PyExc_IOError,
+                      "Majka dictionary is unreadable or invalid");
+    return -1;
+  }
+
+  if (self->dict) dictionary_close(self->dict);
+  Py_XDECREF(self->path);
+  self->dict = dict;
+  self->majka = dict->majka;
+  self->path = PyUnicode_FromString(file);
+  if (!self->scratch_busy) delete [] self->scratch;
+  self->scratch = new char[self->majka->max_results_size];
+  self->scratch_busy = false;
+  return 0;
+}
+
+/* Connects the object to the lookup daemon listening on the socket, returns
+ * false if it does not serve the dictionary of the file.
+ */
+static bool Majka_connect(Majka* self, const char* file, const char* socket) {
+  char real[PATH_MAX];
+  daemon_client* remote;
+
+  // the daemon knows its dictionaries by the paths given to it and resolved
+  if (!realpath(file, real)) {
+    strncpy(real, file, PATH_MAX - 1);
+    real[PATH_MAX - 1] = '\0';
+  }
+  Py_BEGIN_ALLOW_THREADS
+  remote = new daemon_client(socket, real);
+  Py_END_ALLOW_THREADS
+  if (!remote->ready()) {
+    delete remote;
+    return false;
+  }
+  delete self->remote;
+  self->remote = remote;
+  Py_XDECREF(self->path);
+  self->path = PyUnicode_FromString(file);
+  return true;
+}
+
 static int Majka_init(Majka* self, PyObject* args, PyObject* kwds) {
-  const char* file = NULL;
-  static char* kwlist[] = {const_cast<char*>("file"), NULL};
+  const char* file = NULL, * daemon = NULL;
+  int residency = 0;
+  static char* kwlist[] = {const_cast<char*>("file"), const_cast<char*>("resident"),
+                           const_cast<char*>("daemon"), NULL};
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &file)) {
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|siz", kwlist, &file, &residency,
+                                   &daemon)) {
     return -1;
   }
 
@@ -53,513 +592,2560 @@ static int Majka_init(Majka* self, PyObject* args, PyObject* kwds) {
     return -1;
   }
 
-  self->majka = new fsa(file);
+  self->residency = residency;
+  // without the daemon the dictionary is loaded by the process itself
+  if (daemon && !self->dict && Majka_connect(self, file, daemon)) return 0;
+  return Majka_open(self, file);
+}
 
-  if (self->majka->state) {
-      PyErr_SetString(PyExc_IOError,
-                      "Majka dictionary is unreadable or invalid");
+static PyObject* Majka_get_daemon(Majka* self, void* closure) {
+  if (!self->remote) Py_RETURN_NONE;
+  return PyUnicode_FromString(self->remote->socket_path().c_str());
+}
+
+// Raises TypeError for objects served by the daemon, what needs the dictionary
+static bool has_dictionary(const Majka* self, const char* what) {
+  if (self->remote) {
+    PyErr_Format(PyExc_TypeError,
+                 "%s needs a dictionary loaded by the process, not a daemon", what);
+  } else if (!self->dict) {
+    PyErr_SetString(PyExc_TypeError, "Majka object without a dictionary");
+  }
+  return self->dict != NULL;
+}
+
+static PyObject* Majka_get_resident(Majka* self, void* closure) {
+  return PyLong_FromLong(self->majka ? self->majka->resident : 0);
+}
+
+static PyObject* Majka_get_negative(Majka* self, void* closure) {
+  Py_INCREF(self->negative);
+  return self->negative;
+}
+
+static int Majka_set_negative(Majka* self, PyObject* value, void* closure) {
+  PyObject* encoded;
+
+  if (!value || !PyUnicode_Check(value)) {
+    PyErr_SetString(PyExc_TypeError, "negative must be a string");
     return -1;
   }
+  if (!(encoded = PyUnicode_AsUTF8String(value))) return -1;
+  Py_INCREF(value);
+  Py_DECREF(self->negative);
+  self->negative = value;
+  Py_DECREF(self->negative_utf8);
+  self->negative_utf8 = encoded;
+  return 0;
+}
+
+static int Majka_set_scores(Majka* self, PyObject* value, void* closure);
+static int Majka_set_tagset(Majka* self, PyObject* value, void* closure);
+
+/* Pickling
+ *
+ * Only the path, the identity of the file, the settings and the overlay
+ * (in its compact serialized form) are pickled.
+ */
+
+static PyObject* Majka_reduce(Majka* self, PyObject* noargs) {
+  // paths are resolved, workers may run in another directory
+  if (self->remote) {  // connects again, to the daemon or the file
+    std::string extra = self->extra->dump();
+    return Py_BuildValue("O(sis){s:i,s:O,s:O,s:O,s:O,s:i,s:O,s:O,s:O,s:N,s:O}",
+                         Py_TYPE(self), self->remote->dictionary_path().c_str(), self->residency,
+                         self->remote->socket_path().c_str(),
+                         "flags", self->flags,
+                         "tags", self->tags ? Py_True : Py_False,
+                         "compact_tag", self->compact_tag ? Py_True : Py_False,
+                         "packed_tag", self->packed_tag ? Py_True : Py_False,
+                         "first_only", self->first_only ? Py_True : Py_False,
+                         "best", self->best,
+                         "scores", self->scores,
+                         "tagset", self->tagset_path,
+                         "negative", self->negative,
+                         "overlay", PyBytes_FromStringAndSize(extra.data(), extra.size()),
+                         "overlay_override", self->overlay_override ? Py_True : Py_False);
+  }
+  if (!has_dictionary(self, "pickle")) return NULL;
+  std::string extra = self->extra->dump();
+  return Py_BuildValue("O(si){s:L,s:L,s:i,s:O,s:O,s:O,s:O,s:i,s:O,s:O,s:O,s:N,s:O}",
+                       Py_TYPE(self), self->dict->path.c_str(), self->residency,
+                       "size", self->dict->size,
+                       "mtime", self->dict->mtime,
+                       "flags", self->flags,
+                       "tags", self->tags ? Py_True : Py_False,
+                       "compact_tag", self->compact_tag ? Py_True : Py_False,
+                       "packed_tag", self->packed_tag ? Py_True : Py_False,
+                       "first_only", self->first_only ? Py_True : Py_False,
+                       "best", self->best,
+                       "scores", self->scores,
+                       "tagset", self->tagset_path,
+                       "negative", self->negative,
+                       "overlay", PyBytes_FromStringAndSize(extra.data(), extra.size()),
+                       "overlay_override", self->overlay_override ? Py_True : Py_False);
+}
+
+static int state_bool(PyObject* state, const char* key, bool* value) {
+  PyObject* obj = PyDict_GetItemString(state, key);
+  int rv;
+  if (!obj) return 0;
+  if ((rv = PyObject_IsTrue(obj)) < 0) return -1;
+  *value = rv;
+  return 0;
+}
+
+static PyObject* Majka_setstate(Majka* self, PyObject* state) {
+  PyObject* obj;
+  long long size, mtime;
+
+  if (!PyDict_Check(state) || (!self->dict && !self->remote)) {
+    PyErr_SetString(PyExc_TypeError, "Invalid Majka state");
+    return NULL;
+  }
+
+  // the identity of the file is not known to objects served by the daemon
+  obj = PyDict_GetItemString(state, "size");
+  size = obj ? PyLong_AsLongLong(obj) : -1;
+  obj = PyDict_GetItemString(state, "mtime");
+  mtime = obj ? PyLong_AsLongLong(obj) : -1;
+  if (PyErr_Occurred()) return NULL;
+  if (self->dict && PyDict_GetItemString(state, "size") &&
+      (size != self->dict->size || mtime != self->dict->mtime)) {
+    PyErr_SetString(PyExc_IOError,
+                    "Majka dictionary changed since the object was pickled");
+    return NULL;
+  }
+
+  if ((obj = PyDict_GetItemString(state, "flags"))) {
+    self->flags = PyLong_AsLong(obj);
+    if (PyErr_Occurred()) return NULL;
+  }
+  if ((obj = PyDict_GetItemString(state, "best"))) {
+    self->best = PyLong_AsLong(obj);
+    if (PyErr_Occurred()) return NULL;
+  }
+  if ((obj = PyDict_GetItemString(state, "scores")) &&
+      Majka_set_scores(self, obj, NULL) < 0) {
+    return NULL;
+  }
+  if ((obj = PyDict_GetItemString(state, "tagset")) &&
+      Majka_set_tagset(self, obj, NULL) < 0) {
+    return NULL;
+  }
+  if (state_bool(state, "tags", &self->tags) < 0 ||
+      state_bool(state, "compact_tag", &self->compact_tag) < 0 ||
+      state_bool(state, "packed_tag", &self->packed_tag) < 0 ||
+      state_bool(state, "first_only", &self->first_only) < 0 ||
+      state_bool(state, "overlay_override", &self->overlay_override) < 0) {
+    return NULL;
+  }
+  if ((obj = PyDict_GetItemString(state, "overlay")) &&
+      (!PyBytes_Check(obj) ||
+       !self->extra->load(PyBytes_AS_STRING(obj), PyBytes_GET_SIZE(obj)))) {
+    PyErr_SetString(PyExc_ValueError, "Invalid Majka overlay state");
+    return NULL;
+  }
+  if ((obj = PyDict_GetItemString(state, "negative")) &&
+      Majka_set_negative(self, obj, NULL) < 0) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+int is_negation(const char* tag_string){
+  if (*tag_string == 'k'){
+    tag_string += 2;
+  }
+  if (*tag_string == 'e') {
+    ++tag_string;
+    if (*tag_string == 'N') {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static PyObject* key_word, * key_filter, * key_lemma, * key_tags, * key_compact_tag,
+    * key_packed_tag, * key_distance;
+
+/* Ranking of results
+ *
+ * A result scores the sum of the weights of the attribute-value pairs of its
+ * compact tag in the table, without a table the value of its frequency
+ * attribute (-1 if it has none). The best ones are selected by a bounded heap
+ * over the raw results, ties keep their order.
+ */
+
+static float result_score(const float* table, const char* entry) {
+  const char* tag = strchr(entry, ':');
+  float score = table ? 0 : -1;
+
+  for (tag = tag ? tag + 1 : "";
+       (tag[0] & 0x80) == 0 && (tag[1] & 0x80) == 0 && tag[0] && tag[1]; tag += 2) {
+    if (table) {
+      score += table[128 * tag[0] + tag[1]];
+    } else if (tag[0] == '~' && tag[1] >= '0' && tag[1] <= '9') {
+      return tag[1] - '0';
+    }
+  }
+  return score;
+}
+
+typedef std::pair<float, int> ranked_result;  // score and index
+
+// Orders better results first
+static bool ranked_better(const ranked_result& a, const ranked_result& b) {
+  return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+/* Points best[] to the k best of the rc results, best first, and returns how
+ * many there are.
+ */
+static int rank_results(const float* table, const char* results, int rc, int k,
+                        const char** best) {
+  std::vector<ranked_result> heap;
+  std::vector<const char*> entries(rc);
+  const char* entry = results;
+  int i;
+
+  heap.reserve(k + 1);
+  for (i = 0; i < rc; i++, entry += strlen(entry) + 1) {
+    entries[i] = entry;
+    // the worst of the best so far is on the top
+    heap.push_back(ranked_result(result_score(table, entry), i));
+    std::push_heap(heap.begin(), heap.end(), ranked_better);
+    if ((int) heap.size() > k) {
+      std::pop_heap(heap.begin(), heap.end(), ranked_better);
+      heap.pop_back();
+    }
+  }
+  std::sort_heap(heap.begin(), heap.end(), ranked_better);
+  for (i = 0; i < (int) heap.size(); i++) best[i] = entries[heap[i].second];
+  return heap.size();
+}
+
+static PyObject* Majka_results(Majka* self, const char* results, int rc) {
+  const char* entry, * colon;
+  PyObject* ret, * lemma, * tags, * option;
+  std::vector<const char*> best;
+  int i;
+
+  if (self->best > 0 && rc > 1) {
+    best.resize(self->best < rc ? self->best : rc);
+    rc = rank_results(self->score_table, results, rc, best.size(), best.data());
+  }
+  if (self->first_only && rc > 1) rc = 1;
+  if (!(ret = PyList_New(rc))) return NULL;
+
+  for (entry = results, i=0; i < rc; i++, entry += strlen(entry) + 1) {
+    if (!best.empty()) entry = best[i];
+    colon = strchr(entry, ':');
+    option = PyDict_New();
+
+    if (!self->tags && is_negation(colon+1)) {
+      std::string negated(PyBytes_AS_STRING(self->negative_utf8),
+                          PyBytes_GET_SIZE(self->negative_utf8));
+      negated.append(entry, colon-entry);
+      lemma = PyUnicode_FromStringAndSize(negated.data(), negated.size());
+    } else {
+      lemma = PyUnicode_FromStringAndSize(entry, colon-entry);
+    }
+    if (!option || !lemma || PyDict_SetItem(option, key_lemma, lemma) < 0) {
+      Py_XDECREF(lemma);
+      Py_XDECREF(option);
+      Py_DECREF(ret);
+      return NULL;
+    }
+    Py_DECREF(lemma);
+
+    if (self->tags) {
+      tags = tagset_of(self)->decode(colon+1);
+      if (!tags || PyDict_SetItem(option, key_tags, tags) < 0) {
+        Py_XDECREF(tags);
+        Py_DECREF(option);
+        Py_DECREF(ret);
+        return NULL;
+      }
+      Py_DECREF(tags);
+    }
+
+    if (self->compact_tag) {
+      PyObject* compact_tag = PyUnicode_FromString(colon+1);
+      PyDict_SetItem(option, key_compact_tag, compact_tag);
+      Py_DECREF(compact_tag);
+    }
+
+    if (self->packed_tag) {
+      PyObject* packed_tag = PyLong_FromUnsignedLongLong(pack_tag(colon+1));
+      PyDict_SetItem(option, key_packed_tag, packed_tag);
+      Py_DECREF(packed_tag);
+    }
+
+    PyList_SET_ITEM(ret, i, option);
+  }
+  return ret;
+}
+
+// Words are passed either as str or as UTF-8 encoded bytes
+static const char* as_utf8(PyObject* obj, Py_ssize_t* len) {
+  if (PyBytes_Check(obj)) {
+    *len = PyBytes_GET_SIZE(obj);
+    return PyBytes_AS_STRING(obj);
+  }
+  if (PyUnicode_Check(obj)) {
+#ifdef PY3K
+    return PyUnicode_AsUTF8AndSize(obj, len);
+#else
+    PyErr_SetString(PyExc_TypeError, "word must be a UTF-8 encoded str");
+    return NULL;
+#endif
+  }
+  PyErr_SetString(PyExc_TypeError, "word must be str or bytes");
+  return NULL;
+}
+
+static PyObject* Majka_get_tagset(Majka* self, void* closure) {
+  Py_INCREF(self->tagset_path);
+  return self->tagset_path;
+}
+
+// Compiles the tagset definition of the file, None for the default tagset
+static int Majka_set_tagset(Majka* self, PyObject* value, void* closure) {
+  tagset* decoder = NULL;
+
+  if (value && value != Py_None) {
+    Py_ssize_t len;
+    const char* path = PyUnicode_Check(value) ? as_utf8(value, &len) : NULL;
+    std::string definition;
+    char buffer[4096];
+    size_t n;
+    FILE* file;
+
+    if (!path) {
+      if (!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "tagset must be a path or None");
+      return -1;
+    }
+    if (!(file = fopen(path, "r"))) {
+      PyErr_Format(PyExc_IOError, "Cannot read tagset file '%s'", path);
+      return -1;
+    }
+    while ((n = fread(buffer, 1, sizeof(buffer), file))) definition.append(buffer, n);
+    fclose(file);
+    decoder = new tagset();
+    if (!decoder->compile(definition.c_str())) {
+      delete decoder;
+      return -1;
+    }
+  } else {
+    value = Py_None;
+  }
+  Py_INCREF(value);
+  Py_DECREF(self->tagset_path);
+  self->tagset_path = value;
+  delete self->decoder;
+  self->decoder = decoder;
+  return 0;
+}
+
+static PyObject* Majka_get_scores(Majka* self, void* closure) {
+  Py_INCREF(self->scores);
+  return self->scores;
+}
+
+// Weights of attribute-value pairs of compact tags, e.g. {'k1': 2, 'c1': 0.5}
+static int Majka_set_scores(Majka* self, PyObject* value, void* closure) {
+  PyObject* pair, * weight;
+  Py_ssize_t pos = 0, len;
+  float* table = NULL;
+  const char* str;
+  double number;
+
+  if (!value) value = Py_None;
+  if (value != Py_None) {
+    if (!PyDict_Check(value)) {
+      PyErr_SetString(PyExc_TypeError, "scores must be a dict or None");
+      return -1;
+    }
+    table = new float[128 * 128]();
+    while (PyDict_Next(value, &pos, &pair, &weight)) {
+      if (!PyUnicode_Check(pair) || !(str = as_utf8(pair, &len)) || len != 2 ||
+          (str[0] & 0x80) || (str[1] & 0x80)) {
+        if (!PyErr_Occurred()) {
+          PyErr_SetString(PyExc_ValueError,
+                          "scores keys must be attribute-value pairs, e.g. 'k1'");
+        }
+        delete [] table;
+        return -1;
+      }
+      number = PyFloat_AsDouble(weight);
+      if (number == -1.0 && PyErr_Occurred()) {
+        delete [] table;
+        return -1;
+      }
+      table[128 * str[0] + str[1]] = number;
+    }
+  }
+  Py_INCREF(value);
+  Py_DECREF(self->scores);
+  self->scores = value;
+  delete [] self->score_table;
+  self->score_table = table;
+  return 0;
+}
+
+/* Tag filters
+ *
+ * A filter is given either as a compact pattern (see tag_filter::parse in
+ * majka.h) or as a dict using the keys and values of the tags returned by find,
+ * e.g. {'pos': 'verb', 'negation': False}, which the tagset of the object maps
+ * back to attribute and value letters. A list of values means any of them.
+ * It is evaluated natively on compact tags before any result is built.
+ */
+
+// Appends the value letters of the key (NULL for a compact attribute letter)
+static int filter_codes(const tagset* names, PyObject* key, PyObject* value,
+                        std::string* codes) {
+  if (PyList_Check(value) || PyTuple_Check(value) || PyAnySet_Check(value)) {
+    PyObject* iter = PyObject_GetIter(value), * item;
+    int rv = 0;
+    if (!iter) return -1;
+    while (rv == 0 && (item = PyIter_Next(iter))) {
+      rv = filter_codes(names, key, item, codes);
+      Py_DECREF(item);
+    }
+    Py_DECREF(iter);
+    return rv || PyErr_Occurred() ? -1 : 0;
+  }
+
+  int found = key ? names->letters_of(key, value, codes) : 0;
+  if (found) return found < 0 ? -1 : 0;
+  if (!key && PyLong_Check(value) && !PyBool_Check(value)) {
+    long number = PyLong_AsLong(value);
+    if (number >= 0 && number <= 9) {
+      codes->push_back('0' + number);
+      return 0;
+    }
+  } else if (PyUnicode_Check(value)) {
+    Py_ssize_t len;
+    const char* name = as_utf8(value, &len);
+    if (!name) return -1;
+    if (len == 1) {  // a compact value letter
+      codes->append(name);
+      return 0;
+    }
+  }
+
+  PyErr_Clear();
+  if (key) {
+    PyErr_Format(PyExc_ValueError, "Invalid value of tag filter key '%U'", key);
+  } else {
+    PyErr_SetString(PyExc_ValueError, "Invalid value of tag filter attribute");
+  }
+  return -1;
+}
+
+// Returns 1 if obj is a filter, 0 if it is None, -1 on error
+static int filter_from_object(const tagset* names, PyObject* obj, tag_filter* filter) {
+  if (!obj || obj == Py_None) return 0;
+
+  if (PyUnicode_Check(obj) || PyBytes_Check(obj)) {
+    Py_ssize_t len;
+    const char* pattern = as_utf8(obj, &len);
+    if (!pattern) return -1;
+    if (!filter->parse(pattern)) {
+      PyErr_Format(PyExc_ValueError, "Invalid tag filter '%s'", pattern);
+      return -1;
+    }
+    return 1;
+  }
+
+  if (PyDict_Check(obj)) {
+    PyObject* name, * value;
+    Py_ssize_t pos = 0, len;
+    while (PyDict_Next(obj, &pos, &name, &value)) {
+      const char* str = PyUnicode_Check(name) ? as_utf8(name, &len) : NULL;
+      unsigned char attribute;
+      std::string codes;
+      if (!str) {
+        PyErr_SetString(PyExc_TypeError, "Tag filter keys must be strings");
+        return -1;
+      }
+      if (!(attribute = names->attribute_of(name)) && len != 1) {
+        PyErr_Format(PyExc_ValueError, "Unknown tag filter key '%s'", str);
+        return -1;
+      }
+      if (filter_codes(names, attribute ? name : NULL, value, &codes) < 0) return -1;
+      if (!filter->restrict(attribute ? attribute : str[0], codes.c_str())) {
+        PyErr_SetString(PyExc_ValueError, "Too many attributes in tag filter");
+        return -1;
+      }
+    }
+    return 1;
+  }
+
+  PyErr_SetString(PyExc_TypeError, "Tag filter must be a string or a dict");
+  return -1;
+}
+
+/* A lookup in the overlay and the automaton of a Majka object, copied out of
+ * it so that it can be run without the GIL.
+ */
+struct lookup {
+  dictionary* dict;
+  fsa* majka;
+  const overlay* extra;
+  bool override;
+  int flags;
+  daemon_client* remote;  // instead of dict and majka
+};
+
+static lookup lookup_of(const Majka* self, int flags) {
+  lookup l = {self->dict, self->majka, self->extra, self->overlay_override, flags,
+              self->remote};
+  return l;
+}
+
+// A lookup run without the GIL holds its dictionary, it may be reloaded meanwhile
+static void lookup_hold(const lookup& l) {
+  if (l.dict) l.dict->refs++;
+}
+
+static void lookup_release(const lookup& l) {
+  if (l.dict) dictionary_close(l.dict);
+}
+
+/* Appends raw results of the word to out, the ones of the overlay first, and
+ * returns their count, -1 if the daemon is not available. Scratch must hold
+ * max_results_size of the automaton.
+ */
+static int majka_lookup(const lookup& l, const char* word, char* scratch,
+                        const tag_filter* filter, std::vector<char>* out) {
+  char* entry;
+  int rc = l.extra->empty() ? 0 : l.extra->find(word, *out, filter), found, i;
+
+  if (rc && l.override) return rc;
+  if (l.remote) {
+    std::vector<int> counts;
+    return l.remote->find(&word, 1, l.flags, filter, *out, counts) ? rc + counts[0] : -1;
+  }
+  found = l.majka->find(word, scratch, l.flags, filter);
+  for (entry = scratch, i = 0; i < found; i++) entry += strlen(entry) + 1;
+  out->insert(out->end(), scratch, entry);
+  return rc + found;
+}
+
+static PyObject* Majka_find_word(Majka* self, PyObject* word, PyObject* filter_obj) {
+  Py_ssize_t len;
+  const char* str = as_utf8(word, &len);
+  tag_filter filter;
+  int filtered;
+  char* results;
+  PyObject* ret;
+  int rc;
+
+  if (!str) return NULL;
+  if ((filtered = filter_from_object(tagset_of(self), filter_obj, &filter)) < 0) return NULL;
+
+  if (self->remote) {
+    std::vector<char> merged;
+    lookup l = lookup_of(self, self->flags);
+    Py_BEGIN_ALLOW_THREADS
+    rc = majka_lookup(l, str, NULL, filtered ? &filter : NULL, &merged);
+    Py_END_ALLOW_THREADS
+    if (rc < 0) {
+      PyErr_SetString(PyExc_IOError, "Majka daemon is not available");
+      return NULL;
+    }
+    return Majka_results(self, merged.data(), rc);
+  }
+
+  // the scratch buffer is not reused if find is reentered (e.g. from a __del__)
+  if (self->scratch_busy) {
+    results = new char[self->majka->max_results_size];
+  } else {
+    results = self->scratch;
+    self->scratch_busy = true;
+  }
+
+  if (self->extra->empty()) {
+    rc = self->majka->find(str, results, self->flags, filtered ? &filter : NULL);
+    ret = Majka_results(self, results, rc);
+  } else {
+    std::vector<char> merged;
+    rc = majka_lookup(lookup_of(self, self->flags), str, results,
+                      filtered ? &filter : NULL, &merged);
+    ret = Majka_results(self, merged.data(), rc);
+  }
+
+  if (results == self->scratch) {
+    self->scratch_busy = false;
+  } else {
+    delete [] results;
+  }
+  return ret;
+}
+
+#ifdef MAJKA_FASTCALL
+/* Assigns positional and keyword arguments to names (interned strings), the
+ * first required ones must be given, the others are set to NULL if missing.
+ */
+static int parse_fastcall(const char* function, PyObject* const* args,
+                          Py_ssize_t nargs, PyObject* kwnames,
+                          PyObject* const* names, PyObject** values,
+                          Py_ssize_t n, Py_ssize_t required) {
+  Py_ssize_t i, k, nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+
+  if (nargs > n) {
+    PyErr_Format(PyExc_TypeError, "%s() takes at most %zd arguments", function, n);
+    return -1;
+  }
+  for (i = 0; i < n; i++) values[i] = i < nargs ? args[i] : NULL;
+  for (k = 0; k < nkw; k++) {
+    PyObject* kw = PyTuple_GET_ITEM(kwnames, k);
+    for (i = 0; i < n && names[i] != kw && PyUnicode_Compare(names[i], kw); i++) {}
+    if (i == n || values[i]) {
+      PyErr_Format(PyExc_TypeError, "%s() got an unexpected or repeated argument '%U'",
+                   function, kw);
+      return -1;
+    }
+    values[i] = args[nargs + k];
+  }
+  for (i = 0; i < required; i++) {
+    if (!values[i]) {
+      PyErr_Format(PyExc_TypeError, "%s() missing required argument '%U'",
+                   function, names[i]);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static PyObject* Majka_find(Majka* self, PyObject* const* args,
+                            Py_ssize_t nargs, PyObject* kwnames) {
+  PyObject* names[] = {key_word, key_filter};
+  PyObject* values[2];
+
+  if (parse_fastcall("find", args, nargs, kwnames, names, values, 2, 1) < 0) {
+    return NULL;
+  }
+  return Majka_find_word(self, values[0], values[1]);
+}
+#else
+static PyObject* Majka_find(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * filter = NULL;
+
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &word, &filter)) {
+    return NULL;
+  }
+  return Majka_find_word(self, word, filter);
+}
+#endif
+
+/* Batch lookups
+ *
+ * Words are copied out of Python objects first, so that the traversal itself
+ * can run without the GIL, and raw results are packed into one arena per
+ * chunk of words. Python objects are built only after all lookups are done.
+ */
+
+static const size_t chunk_words = 256;
+
+struct batch_chunk {
+  size_t from, to;
+  std::vector<char> results;
+  std::vector<size_t> result_at;
+  std::vector<int> counts;
+};
+
+struct batch {
+  tag_filter filter;
+  bool filtered;
+  std::vector<char> words;
+  std::vector<size_t> word_at;
+  std::vector<batch_chunk> chunks;
+};
+
+static int batch_add(batch* b, PyObject* word) {
+  Py_ssize_t len;
+  const char* str = as_utf8(word, &len);
+  if (!str) return -1;
+  b->word_at.push_back(b->words.size());
+  b->words.insert(b->words.end(), str, str + len + 1);
+  return 0;
+}
+
+static int batch_fill(batch* b, PyObject* words) {
+  PyObject* seq = PySequence_Fast(words, "words must be iterable");
+  Py_ssize_t i, n;
+
+  if (!seq) return -1;
+  n = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < n; i++) {
+    if (batch_add(b, PySequence_Fast_GET_ITEM(seq, i)) < 0) {
+      Py_DECREF(seq);
+      return -1;
+    }
+  }
+  Py_DECREF(seq);
+  return 0;
+}
+
+static void batch_split(batch* b) {
+  size_t n = b->word_at.size();
+  for (size_t from = 0; from < n; from += chunk_words) {
+    batch_chunk c;
+    c.from = from;
+    c.to = from + chunk_words < n ? from + chunk_words : n;
+    b->chunks.push_back(c);
+  }
+}
+
+/* Runs all lookups of a chunk; may be called without the GIL held. Stops
+ * early if *cancelled becomes true.
+ */
+// The words of a chunk are sent to the daemon by one request
+static void batch_remote(const batch* b, batch_chunk* c, const lookup& l) {
+  const tag_filter* filter = b->filtered ? &b->filter : NULL;
+  std::vector<const char*> words;
+  std::vector<char> found;
+  std::vector<int> counts;
+  const char* entry, * end;
+  int k;
+
+  for (size_t w = c->from; w < c->to; w++) words.push_back(&b->words[b->word_at[w]]);
+  if (!l.remote->find(words.data(), words.size(), l.flags, filter, found, counts)) {
+    counts.assign(words.size(), -1);
+  }
+  entry = found.data();
+  for (size_t i = 0; i < words.size(); i++) {
+    int rc = 0;
+    c->result_at.push_back(c->results.size());
+    if (counts[i] >= 0) {
+      if (!l.extra->empty()) rc = l.extra->find(words[i], c->results, filter);
+      for (end = entry, k = 0; k < counts[i]; k++) end += strlen(end) + 1;
+      if (!rc || !l.override) {
+        c->results.insert(c->results.end(), entry, end);
+        rc += counts[i];
+      }
+      entry = end;
+    } else {
+      rc = -1;
+    }
+    c->counts.push_back(rc);
+  }
+}
+
+static void batch_run(const batch* b, batch_chunk* c, const lookup& l,
+                      const std::atomic<bool>* cancelled) {
+  if (l.remote) {
+    batch_remote(b, c, l);
+    return;
+  }
+  std::vector<char> scratch(l.majka->max_results_size);
+
+  for (size_t w = c->from; w < c->to; w++) {
+    if (cancelled && cancelled->load(std::memory_order_relaxed)) return;
+    c->result_at.push_back(c->results.size());
+    c->counts.push_back(majka_lookup(l, &b->words[b->word_at[w]], &scratch[0],
+                                     b->filtered ? &b->filter : NULL, &c->results));
+  }
+}
+
+static PyObject* batch_results(Majka* self, const batch* b) {
+  PyObject* ret = PyList_New(b->word_at.size());
+  PyObject* item;
+  size_t i, k = 0;
+
+  if (!ret) return NULL;
+  for (i = 0; i < b->chunks.size(); i++) {
+    const batch_chunk& c = b->chunks[i];
+    for (size_t w = 0; w < c.counts.size(); w++) {
+      if (c.counts[w] < 0) {
+        PyErr_SetString(PyExc_IOError, "Majka daemon is not available");
+        Py_DECREF(ret);
+        return NULL;
+      }
+      item = Majka_results(self, c.results.data() + c.result_at[w], c.counts[w]);
+      if (!item) {
+        Py_DECREF(ret);
+        return NULL;
+      }
+      PyList_SET_ITEM(ret, k++, item);
+    }
+  }
+  return ret;
+}
+
+static PyObject* Majka_find_many(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* words = NULL, * filter = NULL;
+  lookup l = lookup_of(self, self->flags);
+  int filtered;
+  batch b;
+
+  static char* kwlist[] = {const_cast<char*>("words"), const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &words, &filter)) {
+    return NULL;
+  }
+  if ((filtered = filter_from_object(tagset_of(self), filter, &b.filter)) < 0 ||
+      batch_fill(&b, words) < 0) {
+    return NULL;
+  }
+  b.filtered = filtered;
+  batch_split(&b);
+
+  lookup_hold(l);
+  Py_BEGIN_ALLOW_THREADS
+  for (size_t i = 0; i < b.chunks.size(); i++) {
+    batch_run(&b, &b.chunks[i], l, NULL);
+  }
+  Py_END_ALLOW_THREADS
+  lookup_release(l);
+
+  return batch_results(self, &b);
+}
+
+/* Awaitable lookups
+ *
+ * Chunks of an awaited batch are traversed by the shared native pool. The
+ * worker that finishes the last chunk hands the job back to the event loop
+ * through call_soon_threadsafe, where the results are converted and set on
+ * the future. Cancelling the future stops the chunks not yet traversed.
+ */
+
+static pool* workers = NULL;
+static PyObject* get_running_loop = NULL;
+static PyObject* async_done = NULL;
+
+struct async_job {
+  Majka* self;
+  PyObject* loop;
+  PyObject* future;
+  lookup l;
+  bool many;
+  batch b;
+  std::atomic<bool> cancelled;
+  std::atomic<size_t> pending;
+};
+
+static const char* async_job_name = "majka.async_job";
+
+static void async_job_free(PyObject* capsule) {
+  async_job* job = reinterpret_cast<async_job*>(
+      PyCapsule_GetPointer(capsule, async_job_name));
+  lookup_release(job->l);
+  Py_XDECREF(job->self);
+  Py_XDECREF(job->loop);
+  Py_XDECREF(job->future);
+  delete job;
+}
+
+static PyObject* async_job_done(PyObject* unused, PyObject* capsule) {
+  async_job* job = reinterpret_cast<async_job*>(
+      PyCapsule_GetPointer(capsule, async_job_name));
+  PyObject* done, * ret;
+
+  if (!job) return NULL;
+
+  done = PyObject_CallMethod(job->future, const_cast<char*>("done"), NULL);
+  if (!done) return NULL;
+  if (PyObject_IsTrue(done)) {  // cancelled meanwhile
+    Py_DECREF(done);
+    Py_RETURN_NONE;
+  }
+  Py_DECREF(done);
+
+  ret = batch_results(job->self, &job->b);
+  if (ret && !job->many) {
+    PyObject* single = PyList_GET_ITEM(ret, 0);
+    Py_INCREF(single);
+    Py_DECREF(ret);
+    ret = single;
+  }
+  if (!ret) {
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    ret = PyObject_CallMethod(job->future, const_cast<char*>("set_exception"),
+                              const_cast<char*>("O"), value);
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(traceback);
+    return ret;
+  }
+  done = PyObject_CallMethod(job->future, const_cast<char*>("set_result"),
+                             const_cast<char*>("O"), ret);
+  Py_DECREF(ret);
+  return done;
+}
+
+static PyObject* async_job_cancel(PyObject* capsule, PyObject* future) {
+  async_job* job = reinterpret_cast<async_job*>(
+      PyCapsule_GetPointer(capsule, async_job_name));
+  PyObject* cancelled;
+
+  if (!job) return NULL;
+  cancelled = PyObject_CallMethod(future, const_cast<char*>("cancelled"), NULL);
+  if (!cancelled) return NULL;
+  if (PyObject_IsTrue(cancelled)) job->cancelled = true;
+  Py_DECREF(cancelled);
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef async_job_done_def = {
+  "_async_done", (PyCFunction)async_job_done, METH_O, NULL
+};
+
+static PyMethodDef async_job_cancel_def = {
+  "_async_cancel", (PyCFunction)async_job_cancel, METH_O, NULL
+};
+
+// Called on a pool thread once every chunk of the job is traversed
+static void async_job_post(async_job* job, PyObject* capsule) {
+  PyGILState_STATE gil = PyGILState_Ensure();
+  PyObject* rv = PyObject_CallMethod(job->loop,
+                                     const_cast<char*>("call_soon_threadsafe"),
+                                     const_cast<char*>("OO"),
+                                     async_done, capsule);
+  if (rv) {
+    Py_DECREF(rv);
+  } else {
+    PyErr_Clear();  // the loop is already closed, nobody awaits the result
+  }
+  Py_DECREF(capsule);
+  PyGILState_Release(gil);
+}
+
+static PyObject* Majka_submit(Majka* self, PyObject* words, PyObject* filter,
+                              bool many) {
+  PyObject* capsule, * callback, * rv;
+  async_job* job;
+  int filtered;
+
+  if (!get_running_loop) {
+    PyObject* asyncio = PyImport_ImportModule("asyncio");
+    if (!asyncio) return NULL;
+    get_running_loop = PyObject_GetAttrString(asyncio, "get_running_loop");
+    Py_DECREF(asyncio);
+    if (!get_running_loop) return NULL;
+  }
+  if (!async_done) {
+    async_done = PyCFunction_New(&async_job_done_def, NULL);
+    if (!async_done) return NULL;
+  }
+
+  job = new async_job();
+  job->self = self;
+  Py_INCREF(self);
+  job->loop = NULL;
+  job->future = NULL;
+  job->l = lookup_of(self, self->flags);
+  lookup_hold(job->l);
+  job->many = many;
+  job->cancelled = false;
+
+  capsule = PyCapsule_New(job, async_job_name, async_job_free);
+  if (!capsule) {
+    lookup_release(job->l);
+    Py_DECREF(self);
+    delete job;
+    return NULL;
+  }
+
+  if ((filtered = filter_from_object(tagset_of(self), filter, &job->b.filter)) < 0 ||
+      (many ? batch_fill(&job->b, words) : batch_add(&job->b, words)) < 0) {
+    Py_DECREF(capsule);
+    return NULL;
+  }
+  job->b.filtered = filtered;
+  batch_split(&job->b);
+
+  job->loop = PyObject_CallObject(get_running_loop, NULL);
+  if (!job->loop) {
+    Py_DECREF(capsule);
+    return NULL;
+  }
+  job->future = PyObject_CallMethod(job->loop, const_cast<char*>("create_future"), NULL);
+  if (!job->future) {
+    Py_DECREF(capsule);
+    return NULL;
+  }
+
+  if (job->b.chunks.empty()) {
+    rv = PyObject_CallMethod(job->future, const_cast<char*>("set_result"),
+                             const_cast<char*>("N"), PyList_New(0));
+    Py_XDECREF(rv);
+  } else {
+    callback = PyCFunction_New(&async_job_cancel_def, capsule);
+    if (!callback) {
+      Py_DECREF(capsule);
+      return NULL;
+    }
+    rv = PyObject_CallMethod(job->future, const_cast<char*>("add_done_callback"),
+                             const_cast<char*>("O"), callback);
+    Py_DECREF(callback);
+    if (!rv) {
+      Py_DECREF(capsule);
+      return NULL;
+    }
+    Py_DECREF(rv);
+
+    if (!workers) {
+      Py_BEGIN_ALLOW_THREADS
+      workers = new pool();
+      Py_END_ALLOW_THREADS
+    }
+
+    // the reference held by the workers is released in async_job_post
+    Py_INCREF(capsule);
+    job->pending = job->b.chunks.size();
+    for (size_t i = 0; i < job->b.chunks.size(); i++) {
+      batch_chunk* c = &job->b.chunks[i];
+      workers->submit([job, capsule, c]() {
+        batch_run(&job->b, c, job->l, &job->cancelled);
+        if (--job->pending == 0) async_job_post(job, capsule);
+      });
+    }
+  }
+
+  rv = job->future;
+  Py_INCREF(rv);
+  Py_DECREF(capsule);
+  return rv;
+}
+
+static PyObject* Majka_afind(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * filter = NULL;
+
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &word, &filter)) {
+    return NULL;
+  }
+  return Majka_submit(self, word, filter, false);
+}
+
+static PyObject* Majka_afind_many(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* words = NULL, * filter = NULL;
+
+  static char* kwlist[] = {const_cast<char*>("words"), const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &words, &filter)) {
+    return NULL;
+  }
+  return Majka_submit(self, words, filter, true);
+}
+
+// Registered with atexit, so that no worker outlives the interpreter
+static PyObject* majka_shutdown(PyObject* unused, PyObject* noargs) {
+  pool* p = workers;
+  workers = NULL;
+  Py_BEGIN_ALLOW_THREADS
+  delete p;
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef majka_shutdown_def = {
+  "_shutdown", (PyCFunction)majka_shutdown, METH_NOARGS, NULL
+};
+
+/* Hot reload
+ *
+ * The new automaton is loaded with the GIL released, so that other threads
+ * keep looking words up in the old one meanwhile, and then swapped in.
+ * Lookups running without the GIL (batches, awaitables, the C API) hold a
+ * reference to the dictionary they started with; the old automaton is freed
+ * once the last of them is done.
+ */
+
+static PyObject* Majka_reload(Majka* self, PyObject* args, PyObject* kwds) {
+  dictionary* old = self->dict;
+  const char* file = NULL;
+  std::string current;
+  Py_ssize_t len;
+
+  static char* kwlist[] = {const_cast<char*>("file"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &file)) {
+    return NULL;
+  }
+  if (!has_dictionary(self, "reload")) return NULL;
+  if (!file) {  // self->path is replaced by Majka_open
+    if (!(file = as_utf8(self->path, &len))) return NULL;
+    current.assign(file, len);
+    file = current.c_str();
+  }
+  if (Majka_open(self, file) < 0) return NULL;
+  return PyBool_FromLong(self->dict != old);
+}
+
+/* Overlay lexicon
+ *
+ * Words added at runtime are looked up before the automaton; their results
+ * come first, or replace the ones of the automaton if overlay_override is set.
+ * Lookups never wait for updates, each update publishes a new copy of the
+ * overlay, so adding many words by one add_many is much cheaper.
+ */
+
+static int overlay_item(PyObject* word, PyObject* lemma, PyObject* tag,
+                        std::vector<overlay::item>* items) {
+  Py_ssize_t len;
+  const char* str;
+  overlay::item item;
+
+  if (!(str = as_utf8(word, &len))) return -1;
+  item.first.assign(str, len);
+  if (!(str = as_utf8(lemma, &len))) return -1;
+  if (!len || memchr(str, ':', len)) {
+    PyErr_SetString(PyExc_ValueError, "Lemma must be nonempty and must not contain ':'");
+    return -1;
+  }
+  item.second.assign(str, len).append(":");  // results always have a tag, if empty
+  if (tag && tag != Py_None) {
+    if (!(str = as_utf8(tag, &len))) return -1;
+    item.second.append(str, len);
+  }
+  items->push_back(item);
+  return 0;
+}
+
+static PyObject* overlay_add(Majka* self, const std::vector<overlay::item>& items) {
+  size_t added;
+
+  Py_BEGIN_ALLOW_THREADS
+  added = self->extra->add(items);
+  Py_END_ALLOW_THREADS
+  return PyLong_FromSize_t(added);
+}
+
+static PyObject* Majka_add(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * lemma = NULL, * tag = NULL;
+  std::vector<overlay::item> items;
+
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("lemma"),
+                           const_cast<char*>("tag"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|O", kwlist, &word, &lemma, &tag) ||
+      overlay_item(word, lemma, tag, &items) < 0) {
+    return NULL;
+  }
+  return overlay_add(self, items);
+}
+
+static PyObject* Majka_add_many(Majka* self, PyObject* entries) {
+  PyObject* seq = PySequence_Fast(entries, "entries must be iterable");
+  std::vector<overlay::item> items;
+  Py_ssize_t i, n;
+
+  if (!seq) return NULL;
+  n = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < n; i++) {
+    PyObject* word, * lemma, * tag = NULL;
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "OO|O:add_many",
+                          &word, &lemma, &tag) ||
+        overlay_item(word, lemma, tag, &items) < 0) {
+      Py_DECREF(seq);
+      return NULL;
+    }
+  }
+  Py_DECREF(seq);
+  return overlay_add(self, items);
+}
+
+static PyObject* Majka_remove(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * lemma = NULL, * tag = NULL;
+  std::vector<overlay::item> items;
+  size_t removed;
+
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("lemma"),
+                           const_cast<char*>("tag"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO", kwlist, &word, &lemma, &tag)) {
+    return NULL;
+  }
+  if (lemma && lemma != Py_None) {
+    if (overlay_item(word, lemma, tag, &items) < 0) return NULL;
+    // without a tag, all results of the lemma are removed
+    if (!tag || tag == Py_None) items[0].second.resize(items[0].second.size() - 1);
+  } else {
+    Py_ssize_t len;
+    const char* str = as_utf8(word, &len);
+    if (!str) return NULL;
+    items.push_back(overlay::item(std::string(str, len), std::string()));
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  removed = self->extra->remove(items[0].first.c_str(),
+                                items[0].second.empty() ? NULL : items[0].second.c_str());
+  Py_END_ALLOW_THREADS
+  return PyLong_FromSize_t(removed);
+}
+
+static PyObject* Majka_clear_overlay(Majka* self, PyObject* noargs) {
+  Py_BEGIN_ALLOW_THREADS
+  self->extra->clear();
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyObject* Majka_save_overlay(Majka* self, PyObject* args) {
+  const char* file;
+  bool written;
+
+  if (!PyArg_ParseTuple(args, "s:save_overlay", &file)) return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  std::string data = self->extra->dump();
+  FILE* out = fopen(file, "wb");
+  written = out && fwrite(data.data(), 1, data.size(), out) == data.size();
+  written = out && !fclose(out) && written;
+  Py_END_ALLOW_THREADS
+
+  if (!written) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, file);
+  Py_RETURN_NONE;
+}
+
+static PyObject* Majka_load_overlay(Majka* self, PyObject* args) {
+  const char* file;
+  bool read, valid = false;
+
+  if (!PyArg_ParseTuple(args, "s:load_overlay", &file)) return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  std::string data;
+  FILE* in = fopen(file, "rb");
+  char buffer[65536];
+  size_t n;
+  while (in && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) data.append(buffer, n);
+  read = in && !ferror(in);
+  if (in) fclose(in);
+  if (read) valid = self->extra->load(data.data(), data.size());
+  Py_END_ALLOW_THREADS
+
+  if (!read) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, file);
+  if (!valid) {
+    PyErr_Format(PyExc_ValueError, "'%s' is not a Majka overlay", file);
+    return NULL;
+  }
+  return PyLong_FromSize_t(self->extra->size());
+}
+
+static PyObject* Majka_get_overlay_size(Majka* self, void* closure) {
+  return PyLong_FromSize_t(self->extra->size());
+}
+
+/* Fuzzy lookup and completion
+ *
+ * Words of the automaton within a few edits of the given one are found by a
+ * single walk keeping a row of the Levenshtein table per node, subtrees are
+ * abandoned once the whole row exceeds the distance. Completions enumerate
+ * the subtree of the prefix until enough words are found. The overlay is not
+ * searched. Buffers start at a few times the size of an exact lookup and are
+ * doubled while the matches do not fit.
+ */
+
+static const int max_fuzzy_distance = 3;
+
+/* A walk of the automaton run without the GIL: fuzzy if max_distance >= 0,
+ * completion otherwise. Matches point into buffer.
+ */
+static int walk_matches(Majka* self, const char* word, int max_distance,
+                        const tag_filter* filter, std::vector<word_match>* matches,
+                        std::vector<char>* buffer) {
+  lookup l = lookup_of(self, self->flags);
+  int rc = -1;
+
+  lookup_hold(l);
+  if (buffer->size() < 4 * l.majka->max_results_size) {
+    buffer->resize(4 * l.majka->max_results_size);
+  }
+  while (rc < 0) {
+    Py_BEGIN_ALLOW_THREADS
+    rc = max_distance >= 0
+      ? l.majka->find_fuzzy(word, buffer->data(), buffer->size(), max_distance,
+                            matches->data(), matches->size(), l.flags, filter)
+      : l.majka->complete(word, buffer->data(), buffer->size(),
+                          matches->data(), matches->size(), l.flags, filter);
+    Py_END_ALLOW_THREADS
+    if (rc < 0) {
+      buffer->resize(2 * buffer->size());
+      if (max_distance >= 0) matches->resize(2 * matches->size());
+    }
+  }
+  lookup_release(l);
+  return rc;
+}
+
+// Results of the match with the word (and the distance unless NULL) added
+static PyObject* match_results(Majka* self, const word_match& m, PyObject* distance) {
+  PyObject* results = Majka_results(self, m.results, m.count), * word;
+  Py_ssize_t i;
+
+  if (!results) return NULL;
+  if (!(word = PyUnicode_FromString(m.word))) {
+    Py_DECREF(results);
+    return NULL;
+  }
+  for (i = 0; i < PyList_GET_SIZE(results); i++) {
+    PyObject* option = PyList_GET_ITEM(results, i);
+    if (PyDict_SetItem(option, key_word, word) < 0 ||
+        (distance && PyDict_SetItem(option, key_distance, distance) < 0)) {
+      Py_DECREF(word);
+      Py_DECREF(results);
+      return NULL;
+    }
+  }
+  Py_DECREF(word);
+  return results;
+}
+
+static PyObject* Majka_find_fuzzy(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * filter_obj = NULL, * ret, * results, * distance;
+  int max_distance = 1, filtered, rc, d, i, j;
+  std::vector<word_match> matches(64);
+  std::vector<char> buffer;
+  tag_filter filter;
+  Py_ssize_t len;
+  const char* str;
+
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("max_distance"),
+                           const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|iO", kwlist, &word,
+                                   &max_distance, &filter_obj)) {
+    return NULL;
+  }
+  if (max_distance < 0 || max_distance > max_fuzzy_distance) {
+    PyErr_Format(PyExc_ValueError, "max_distance must be between 0 and %d",
+                 max_fuzzy_distance);
+    return NULL;
+  }
+  if (!has_dictionary(self, "find_fuzzy") || !(str = as_utf8(word, &len))) return NULL;
+  if ((filtered = filter_from_object(tagset_of(self), filter_obj, &filter)) < 0) return NULL;
+
+  rc = walk_matches(self, str, max_distance, filtered ? &filter : NULL,
+                    &matches, &buffer);
+
+  // the closest words first, otherwise in the order of the automaton
+  if (!(ret = PyList_New(0))) return NULL;
+  for (d = 0; d <= max_distance; d++) {
+    if (!(distance = PyLong_FromLong(d))) break;
+    for (i = 0; i < rc; i++) {
+      if (matches[i].distance != d) continue;
+      if (!(results = match_results(self, matches[i], distance))) break;
+      for (j = 0; j < PyList_GET_SIZE(results); j++) {
+        if (PyList_Append(ret, PyList_GET_ITEM(results, j)) < 0) break;
+      }
+      Py_DECREF(results);
+      if (PyErr_Occurred()) break;
+    }
+    Py_DECREF(distance);
+    if (PyErr_Occurred()) break;
+  }
+  if (PyErr_Occurred()) {
+    Py_DECREF(ret);
+    return NULL;
+  }
+  return ret;
+}
+
+static PyObject* Majka_complete(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* prefix = NULL, * by_lemma = NULL, * filter_obj = NULL, * ret = NULL,
+      * results, * lemmas = NULL;
+  int limit = 10, filtered, rc, i;
+  std::vector<word_match> matches;
+  std::vector<char> buffer;
+  tag_filter filter;
+  Py_ssize_t len, j;
+  const char* str;
+  bool unique;
+
+  static char* kwlist[] = {const_cast<char*>("prefix"), const_cast<char*>("limit"),
+                           const_cast<char*>("by_lemma"), const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|iOO", kwlist, &prefix,
+                                   &limit, &by_lemma, &filter_obj)) {
+    return NULL;
+  }
+  if (limit < 0) {
+    PyErr_SetString(PyExc_ValueError, "limit must not be negative");
+    return NULL;
+  }
+  if (!has_dictionary(self, "complete") || !(str = as_utf8(prefix, &len))) return NULL;
+  if ((filtered = filter_from_object(tagset_of(self), filter_obj, &filter)) < 0) return NULL;
+  unique = false;
+  if (by_lemma) {
+    if ((i = PyObject_IsTrue(by_lemma)) < 0) return NULL;
+    unique = i;
+  }
+
+  // limit counts words, or lemmas with by_lemma; words of a lemma already
+  // returned do not count, more of them are walked then
+  matches.resize(limit);
+  while (limit) {
+    rc = walk_matches(self, str, -1, filtered ? &filter : NULL, &matches, &buffer);
+    Py_XDECREF(ret);
+    Py_XDECREF(lemmas);
+    lemmas = NULL;
+    if (!(ret = PyList_New(0)) || (unique && !(lemmas = PySet_New(NULL)))) break;
+    for (i = 0; i < rc && (!unique || PyList_GET_SIZE(ret) < limit); i++) {
+      if (!(results = match_results(self, matches[i], NULL))) break;
+      for (j = 0; j < PyList_GET_SIZE(results) && (!unique || PyList_GET_SIZE(ret) < limit); j++) {
+        PyObject* option = PyList_GET_ITEM(results, j), * lemma;
+        int seen = 0;
+        if (unique) {
+          lemma = PyDict_GetItem(option, key_lemma);
+          if ((seen = PySet_Contains(lemmas, lemma)) < 0 ||
+              (!seen && PySet_Add(lemmas, lemma) < 0)) {
+            break;
+          }
+          if (seen) continue;
+        }
+        if (PyList_Append(ret, option) < 0) break;
+      }
+      Py_DECREF(results);
+      if (PyErr_Occurred()) break;
+    }
+    if (PyErr_Occurred() || !unique || PyList_GET_SIZE(ret) == limit ||
+        rc < (int) matches.size()) {
+      break;
+    }
+    matches.resize(2 * matches.size());
+  }
+  Py_XDECREF(lemmas);
+  if (PyErr_Occurred()) {
+    Py_XDECREF(ret);
+    return NULL;
+  }
+  return ret ? ret : PyList_New(0);
+}
+
+static PyObject* Majka_decompose(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * filter_obj = NULL, * ret, * split, * item;
+  std::vector<compound_split> splits(16);
+  std::vector<char> buffer;
+  tag_filter filter;
+  int filtered, rc = -1, i;
+  Py_ssize_t len;
+  const char* str;
+
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("filter"), NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &word, &filter_obj)) {
+    return NULL;
+  }
+  if (!has_dictionary(self, "decompose") || !(str = as_utf8(word, &len))) return NULL;
+  if ((filtered = filter_from_object(tagset_of(self), filter_obj, &filter)) < 0) return NULL;
+
+  lookup l = lookup_of(self, self->flags);
+  lookup_hold(l);
+  buffer.resize(4 * l.majka->max_results_size);
+  while (rc < 0) {
+    Py_BEGIN_ALLOW_THREADS
+    rc = l.majka->decompose(str, buffer.data(), buffer.size(), splits.data(), splits.size(),
+                            l.flags, filtered ? &filter : NULL);
+    Py_END_ALLOW_THREADS
+    if (rc < 0) {
+      buffer.resize(2 * buffer.size());
+      splits.resize(2 * splits.size());
+    }
+  }
+  lookup_release(l);
+
+  if (!(ret = PyList_New(rc))) return NULL;
+  for (i = 0; i < rc; i++) {
+    if (!(split = PyDict_New())) break;
+    PyList_SET_ITEM(ret, i, split);
+    if (!(item = PyLong_FromLong(splits[i].at))) break;
+    if (PyDict_SetItemString(split, "at", item) < 0) {
+      Py_DECREF(item);
+      break;
+    }
+    Py_DECREF(item);
+    if (!(item = match_results(self, splits[i].head, NULL))) break;
+    if (PyDict_SetItemString(split, "head", item) < 0) {
+      Py_DECREF(item);
+      break;
+    }
+    Py_DECREF(item);
+    if (!(item = match_results(self, splits[i].tail, NULL))) break;
+    if (PyDict_SetItemString(split, "tail", item) < 0) {
+      Py_DECREF(item);
+      break;
+    }
+    Py_DECREF(item);
+  }
+  if (PyErr_Occurred()) {
+    Py_DECREF(ret);
+    return NULL;
+  }
+  return ret;
+}
+
+/* Aggregation
+ *
+ * Counts of lemmas, compact tags or tag attributes over many words are
+ * accumulated natively, no result object is built per word. Words are read in
+ * blocks, so that an iterable or a text of any length takes bounded memory,
+ * and the chunks of a block are traversed by the shared native pool. A group
+ * is a string of its key values, each terminated by '\0', a missing tag
+ * attribute is "\xff" (never in UTF-8).
+ */
+
+static const size_t count_block_words = 64 * chunk_words;
+static const char count_missing[] = "\xff";
+
+enum { group_word, group_lemma, group_tag, group_attribute };
+enum { ambiguity_first, ambiguity_best, ambiguity_all, ambiguity_fractional };
+
+struct count_key {
+  int kind;
+  char attribute;  // of group_attribute
+};
+
+struct count_settings {
+  std::vector<count_key> by;
+  int ambiguity;
+  std::string negative;  // prefixed to lemmas of negations, as by find
+  std::vector<float> scores;  // copy of the ranking table for ambiguity_best
+};
+
+typedef std::unordered_map<std::string, double> count_table;
+
+static int count_key_of(const tagset* names, PyObject* name, count_key* key) {
+  Py_ssize_t len;
+  const char* str = as_utf8(name, &len);
+
+  if (!str) return -1;
+  key->attribute = 0;
+  if (!strcmp(str, "word")) {
+    key->kind = group_word;
+  } else if (!strcmp(str, "lemma")) {
+    key->kind = group_lemma;
+  } else if (!strcmp(str, "tag")) {
+    key->kind = group_tag;
+  } else {
+    key->attribute = PyUnicode_Check(name) ? names->attribute_of(name) : 0;
+    if (!key->attribute && len != 1) {
+      PyErr_Format(PyExc_ValueError, "Unknown grouping key '%s'", str);
+      return -1;
+    }
+    key->kind = group_attribute;
+    if (!key->attribute) key->attribute = str[0];
+  }
+  return 0;
+}
+
+// Appends the group of the result (lemma:tag) of the word to group
+static void count_group(const count_settings& s, const char* word, const char* entry,
+                        std::string* group) {
+  const char* colon = strchr(entry, ':');
+  const char* tag = colon ? colon + 1 : entry + strlen(entry);
+  size_t lemma_len = colon ? colon - entry : strlen(entry);
+
+  for (size_t i = 0; i < s.by.size(); i++) {
+    switch (s.by[i].kind) {
+    case group_word:
+      group->append(word);
+      break;
+    case group_lemma:
+      if (!s.negative.empty() && is_negation(tag)) group->append(s.negative);
+      group->append(entry, lemma_len);
+      break;
+    case group_tag:
+      group->append(tag);
+      break;
+    default: {
+      const char* pair = tag;
+      while (pair[0] && pair[1] && pair[0] != s.by[i].attribute) pair += 2;
+      if (pair[0] && pair[1]) {
+        group->push_back(pair[1]);
+      } else {
+        group->append(count_missing);
+      }
+    }
+    }
+    group->push_back('\0');
+  }
+}
+
+/* Counts the results of a traversed chunk into table and frees them, returns
+ * false if the daemon was not available.
+ */
+static bool count_chunk(const count_settings& s, const batch* b, batch_chunk* c,
+                        count_table* table) {
+  std::vector<std::string> groups;
+  std::string group;
+  const char* entry;
+
+  for (size_t w = 0; w < c->counts.size(); w++) {
+    const char* word = &b->words[b->word_at[c->from + w]];
+    int rc = c->counts[w];
+    if (rc < 0) return false;
+    if (!rc) continue;
+    entry = &c->results[c->result_at[w]];
+    if (s.ambiguity == ambiguity_first) {
+      rc = 1;
+    } else if (s.ambiguity == ambiguity_best) {
+      rc = rank_results(s.scores.empty() ? NULL : s.scores.data(), entry, rc, 1, &entry);
+    }
+    groups.clear();
+    for (int i = 0; i < rc; i++, entry += strlen(entry) + 1) {
+      group.clear();
+      count_group(s, word, entry, &group);
+      if (s.ambiguity == ambiguity_fractional) {
+        (*table)[group] += 1.0 / rc;
+      } else {
+        groups.push_back(group);
+      }
+    }
+    // every group of the word counts once
+    std::sort(groups.begin(), groups.end());
+    groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+    for (size_t i = 0; i < groups.size(); i++) (*table)[groups[i]] += 1;
+  }
+  std::vector<char>().swap(c->results);
+  return true;
+}
+
+/* Traverses and counts the chunks of a block into table, in parallel if the
+ * pool has more workers; may be called without the GIL held.
+ */
+static bool count_block(const count_settings& s, batch* b, const lookup& l,
+                        bool parallel, count_table* table) {
+  std::vector<count_table> tables(b->chunks.size());
+  std::atomic<bool> available(true);
+  std::condition_variable finished;
+  std::mutex lock;
+  size_t pending;
+
+  if (!parallel || b->chunks.size() < 2) {
+    for (size_t i = 0; i < b->chunks.size(); i++) {
+      batch_run(b, &b->chunks[i], l, NULL);
+      if (!count_chunk(s, b, &b->chunks[i], table)) return false;
+    }
+    return true;
+  }
+
+  pending = b->chunks.size();
+  for (size_t i = 0; i < b->chunks.size(); i++) {
+    workers->submit([&, i]() {
+      batch_run(b, &b->chunks[i], l, NULL);
+      if (!count_chunk(s, b, &b->chunks[i], &tables[i])) available = false;
+      std::lock_guard<std::mutex> guard(lock);
+      if (--pending == 0) finished.notify_one();
+    });
+  }
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, [&]() { return pending == 0; });
+  }
+  for (size_t i = 0; i < tables.size(); i++) {
+    for (count_table::const_iterator it = tables[i].begin(); it != tables[i].end(); ++it) {
+      (*table)[it->first] += it->second;
+    }
+  }
+  return available;
+}
+
+// Whitespace and ASCII punctuation separate words of a text
+static inline bool count_separator(unsigned char c) {
+  return c < 128 && !isalnum(c);
+}
+
+/* Fills the words of the next block from the iterable (a text if text is
+ * not NULL, from *at on), returns 1 if more may follow, 0 at the end, -1 on
+ * error.
+ */
+static int count_fill(batch* b, PyObject* iter, const char* text, Py_ssize_t len,
+                      Py_ssize_t* at) {
+  PyObject* item;
+
+  b->words.clear();
+  b->word_at.clear();
+  b->chunks.clear();
+  while (b->word_at.size() < count_block_words) {
+    if (text) {
+      Py_ssize_t from;
+      while (*at < len && count_separator(text[*at])) ++*at;
+      if (*at == len) return 0;
+      for (from = *at; *at < len && !count_separator(text[*at]); ++*at) {}
+      b->word_at.push_back(b->words.size());
+      b->words.insert(b->words.end(), text + from, text + *at);
+      b->words.push_back('\0');
+      continue;
+    }
+    if (!(item = PyIter_Next(iter))) return PyErr_Occurred() ? -1 : 0;
+    if (batch_add(b, item) < 0) {
+      Py_DECREF(item);
+      return -1;
+    }
+    Py_DECREF(item);
+  }
+  return 1;
+}
+
+static PyObject* count_value(const char* value) {
+  if (!strcmp(value, count_missing)) Py_RETURN_NONE;
+  return PyUnicode_FromString(value);
+}
+
+// The counts as a dict of groups, most frequent first
+static PyObject* count_results(const count_settings& s, const count_table& table,
+                               bool tuples, PyObject* by, bool columns) {
+  std::vector<std::pair<double, const std::string*> > sorted;
+  PyObject* ret, * group = NULL, * number = NULL, * lists = NULL, * name;
+  size_t i, k;
+
+  sorted.reserve(table.size());
+  for (count_table::const_iterator it = table.begin(); it != table.end(); ++it) {
+    sorted.push_back(std::make_pair(-it->second, &it->first));
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const std::pair<double, const std::string*>& a,
+               const std::pair<double, const std::string*>& b) {
+              return a.first != b.first ? a.first < b.first : *a.second < *b.second;
+            });
+
+  if (!(ret = PyDict_New())) return NULL;
+  if (columns) {
+    // one list per grouping key and the counts
+    if (!(lists = PyList_New(s.by.size() + 1))) goto error;
+    for (k = 0; k <= s.by.size(); k++) {
+      PyObject* list = PyList_New(sorted.size());
+      if (!list) goto error;
+      PyList_SET_ITEM(lists, k, list);
+      if (k < s.by.size()) {
+        name = tuples ? PySequence_Fast_GET_ITEM(by, k) : by;
+        Py_INCREF(name);
+      } else if (!(name = PyUnicode_FromString("count"))) {
+        goto error;
+      }
+      if (PyDict_SetItem(ret, name, list) < 0) {
+        Py_DECREF(name);
+        goto error;
+      }
+      Py_DECREF(name);
+    }
+  }
+  for (i = 0; i < sorted.size(); i++) {
+    const char* value = sorted[i].second->c_str();
+    number = s.ambiguity == ambiguity_fractional
+      ? PyFloat_FromDouble(-sorted[i].first)
+      : PyLong_FromDouble(-sorted[i].first);
+    if (!number || (tuples && !(group = PyTuple_New(s.by.size())))) goto error;
+    for (k = 0; k < s.by.size(); k++, value += strlen(value) + 1) {
+      PyObject* item = count_value(value);
+      if (!item) goto error;
+      if (columns) {
+        PyList_SET_ITEM(PyList_GET_ITEM(lists, k), i, item);
+      } else if (tuples) {
+        PyTuple_SET_ITEM(group, k, item);
+      } else {
+        group = item;
+      }
+    }
+    if (columns) {
+      PyList_SET_ITEM(PyList_GET_ITEM(lists, s.by.size()), i, number);
+    } else {
+      if (PyDict_SetItem(ret, group, number) < 0) goto error;
+      Py_DECREF(group);
+      Py_DECREF(number);
+    }
+    group = number = NULL;
+  }
+  Py_XDECREF(lists);
+  return ret;
+
+error:
+  Py_XDECREF(group);
+  Py_XDECREF(number);
+  Py_XDECREF(lists);
+  Py_DECREF(ret);
+  return NULL;
+}
+
+static PyObject* Majka_count(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* words = NULL, * by = NULL, * filter = NULL, * columns_obj = NULL,
+      * parallel_obj = NULL, * iter = NULL;
+  const char* ambiguity = NULL, * text = NULL;
+  int filtered, columns = 0, parallel = 1, more = 1;
+  Py_ssize_t len = 0, at = 0, i;
+  lookup l = lookup_of(self, self->flags);
+  count_settings s;
+  count_table table;
+  bool tuples, available = true;
+  batch b;
+
+  static char* kwlist[] = {const_cast<char*>("words"), const_cast<char*>("by"),
+                           const_cast<char*>("ambiguity"), const_cast<char*>("filter"),
+                           const_cast<char*>("columns"), const_cast<char*>("parallel"),
+                           NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OzOOO", kwlist, &words, &by,
+                                   &ambiguity, &filter, &columns_obj, &parallel_obj)) {
+    return NULL;
+  }
+  if ((columns_obj && (columns = PyObject_IsTrue(columns_obj)) < 0) ||
+      (parallel_obj && (parallel = PyObject_IsTrue(parallel_obj)) < 0)) {
+    return NULL;
+  }
+
+  if (!by) by = key_lemma;
+  tuples = PyTuple_Check(by) || PyList_Check(by);
+  if (tuples) {
+    if (!PySequence_Fast_GET_SIZE(by)) {
+      PyErr_SetString(PyExc_ValueError, "No grouping key given");
+      return NULL;
+    }
+    s.by.resize(PySequence_Fast_GET_SIZE(by));
+    for (i = 0; i < PySequence_Fast_GET_SIZE(by); i++) {
+      if (count_key_of(tagset_of(self), PySequence_Fast_GET_ITEM(by, i), &s.by[i]) < 0) {
+        return NULL;
+      }
+    }
+  } else {
+    s.by.resize(1);
+    if (count_key_of(tagset_of(self), by, &s.by[0]) < 0) return NULL;
+  }
+
+  if (!ambiguity) {
+    s.ambiguity = self->first_only ? ambiguity_first : ambiguity_all;
+  } else if (!strcmp(ambiguity, "first")) {
+    s.ambiguity = ambiguity_first;
+  } else if (!strcmp(ambiguity, "best")) {
+    s.ambiguity = ambiguity_best;
+    if (self->score_table) s.scores.assign(self->score_table, self->score_table + 128 * 128);
+  } else if (!strcmp(ambiguity, "all")) {
+    s.ambiguity = ambiguity_all;
+  } else if (!strcmp(ambiguity, "fractional")) {
+    s.ambiguity = ambiguity_fractional;
+  } else {
+    PyErr_Format(PyExc_ValueError, "Unknown ambiguity policy '%s'", ambiguity);
+    return NULL;
+  }
+  if (!self->tags) {
+    s.negative.assign(PyBytes_AS_STRING(self->negative_utf8),
+                      PyBytes_GET_SIZE(self->negative_utf8));
+  }
+
+  if ((filtered = filter_from_object(tagset_of(self), filter, &b.filter)) < 0) return NULL;
+  b.filtered = filtered;
+  if (PyUnicode_Check(words) || PyBytes_Check(words)) {
+    if (!(text = as_utf8(words, &len))) return NULL;
+  } else if (!(iter = PyObject_GetIter(words))) {
+    return NULL;
+  }
+
+  if (parallel && !workers) {
+    Py_BEGIN_ALLOW_THREADS
+    workers = new pool();
+    Py_END_ALLOW_THREADS
+  }
+  parallel = parallel && workers->size() > 1;
+
+  lookup_hold(l);
+  while (more && available) {
+    // a text stays referenced by words while the GIL is released
+    if ((more = count_fill(&b, iter, text, len, &at)) < 0) break;
+    batch_split(&b);
+    Py_BEGIN_ALLOW_THREADS
+    available = count_block(s, &b, l, parallel, &table);
+    Py_END_ALLOW_THREADS
+  }
+  lookup_release(l);
+  Py_XDECREF(iter);
+
+  if (more < 0) return NULL;
+  if (!available) {
+    PyErr_SetString(PyExc_IOError, "Majka daemon is not available");
+    return NULL;
+  }
+  return count_results(s, table, tuples, by, columns);
+}
+
+/* Streaming lookups
+ *
+ * imap reads words of an iterable in chunks and has the chunks ahead of the
+ * one being consumed traversed by the shared native pool, at most `threads`
+ * of them at once, so that memory stays bounded whatever the length of the
+ * input. Results are converted and yielded in the order of the words. An
+ * error of the iterable is raised once the words read before it are yielded.
+ */
+
+struct stream_chunk {
+  batch b;
+  bool done;  // under stream_state::lock
+};
+
+struct stream_state {
+  lookup l;
+  std::mutex lock;
+  std::condition_variable finished;
+  std::atomic<bool> cancelled;
+};
+
+typedef struct {
+  PyObject_HEAD
+  Majka* majka;
+  PyObject* source;                    // NULL once exhausted
+  PyObject* filter;
+  stream_state* state;
+  std::deque<stream_chunk*>* queue;    // submitted to the pool, in order
+  size_t chunk, ahead;
+  stream_chunk* current;               // being consumed
+  size_t part, word;                   // next result of current
+  PyObject* error_type, * error_value, * error_traceback;
+} MajkaStream;
+
+static void stream_wait(stream_state* state, stream_chunk* c) {
+  Py_BEGIN_ALLOW_THREADS
+  std::unique_lock<std::mutex> guard(state->lock);
+  state->finished.wait(guard, [c]() { return c->done; });
+  Py_END_ALLOW_THREADS
+}
+
+// Reads and submits chunks until enough of them are ahead or the words end
+static void stream_fill(MajkaStream* self) {
+  while (self->source && self->queue->size() < self->ahead) {
+    stream_chunk* c = new stream_chunk();
+    PyObject* item;
+    int status = filter_from_object(tagset_of(self->majka), self->filter, &c->b.filter);
+
+    c->b.filtered = status > 0;
+    c->done = false;
+    while (status >= 0 && c->b.word_at.size() < self->chunk &&
+           (item = PyIter_Next(self->source))) {
+      status = batch_add(&c->b, item);
+      Py_DECREF(item);
+    }
+    if (status < 0 || PyErr_Occurred()) {
+      PyErr_Fetch(&self->error_type, &self->error_value, &self->error_traceback);
+    }
+    if (c->b.word_at.size() < self->chunk) Py_CLEAR(self->source);
+    if (c->b.word_at.empty()) {
+      delete c;
+      break;
+    }
+    batch_split(&c->b);
+    self->queue->push_back(c);
+
+    stream_state* state = self->state;
+    workers->submit([state, c]() {
+      for (size_t i = 0; i < c->b.chunks.size(); i++) {
+        batch_run(&c->b, &c->b.chunks[i], state->l, &state->cancelled);
+      }
+      std::lock_guard<std::mutex> guard(state->lock);
+      c->done = true;
+      state->finished.notify_all();
+    });
+  }
+}
+
+static PyObject* MajkaStream_next(MajkaStream* self) {
+  if (!self->majka) return NULL;  // cleared by the garbage collector
+  while (true) {
+    stream_chunk* c = self->current;
+    if (c) {
+      while (self->part < c->b.chunks.size() &&
+             self->word == c->b.chunks[self->part].counts.size()) {
+        self->part++;
+        self->word = 0;
+      }
+      if (self->part < c->b.chunks.size()) {
+        const batch_chunk& part = c->b.chunks[self->part];
+        size_t w = self->word++;
+        if (part.counts[w] < 0) {
+          PyErr_SetString(PyExc_IOError, "Majka daemon is not available");
+          return NULL;
+        }
+        return Majka_results(self->majka, part.results.data() + part.result_at[w],
+                             part.counts[w]);
+      }
+      delete c;
+      self->current = NULL;
+    }
+
+    stream_fill(self);
+    if (self->queue->empty()) {
+      if (self->error_type) {
+        PyErr_Restore(self->error_type, self->error_value, self->error_traceback);
+        self->error_type = self->error_value = self->error_traceback = NULL;
+      }
+      return NULL;
+    }
+    self->current = self->queue->front();
+    self->queue->pop_front();
+    self->part = self->word = 0;
+    // the chunks behind are traversed while this one is consumed
+    stream_fill(self);
+    stream_wait(self->state, self->current);
+  }
+}
+
+/* The iterable (a generator) may refer to the stream, cycles are collected */
+static int MajkaStream_traverse(MajkaStream* self, visitproc visit, void* arg) {
+  Py_VISIT(self->majka);
+  Py_VISIT(self->source);
+  Py_VISIT(self->filter);
+  Py_VISIT(self->error_type);
+  Py_VISIT(self->error_value);
+  Py_VISIT(self->error_traceback);
+  return 0;
+}
+
+// The chunks in flight need the lookup only, they are left to the dealloc
+static int MajkaStream_clear(MajkaStream* self) {
+  Py_CLEAR(self->majka);
+  Py_CLEAR(self->source);
+  Py_CLEAR(self->filter);
+  Py_CLEAR(self->error_type);
+  Py_CLEAR(self->error_value);
+  Py_CLEAR(self->error_traceback);
+  return 0;
+}
+
+static void MajkaStream_dealloc(MajkaStream* self) {
+  PyObject_GC_UnTrack(self);
+  if (self->state) {
+    self->state->cancelled = true;
+    while (!self->queue->empty()) {
+      stream_wait(self->state, self->queue->front());
+      delete self->queue->front();
+      self->queue->pop_front();
+    }
+    lookup_release(self->state->l);
+    delete self->state;
+  }
+  delete self->queue;
+  delete self->current;
+  MajkaStream_clear(self);
+  PyObject_GC_Del(self);
+}
+
+static PyTypeObject MajkaStreamType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "majka.MajkaStream",       /* tp_name */
+  sizeof(MajkaStream),       /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  (destructor)MajkaStream_dealloc, /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_reserved */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  0,                         /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+  "Results of the words of an iterable, looked up ahead by native threads", /* tp_doc */
+  (traverseproc)MajkaStream_traverse, /* tp_traverse */
+  (inquiry)MajkaStream_clear, /* tp_clear */
+  0,                         /* tp_richcompare */
+  0,                         /* tp_weaklistoffset */
+  PyObject_SelfIter,         /* tp_iter */
+  (iternextfunc)MajkaStream_next, /* tp_iternext */
+};
+
+static PyObject* Majka_imap(Majka* self, PyObject* args, PyObject* kwds) {
+  PyObject* words = NULL, * filter = NULL, * source;
+  Py_ssize_t chunk = chunk_words, threads = 0;
+  tag_filter check;
+  MajkaStream* stream;
+
+  static char* kwlist[] = {const_cast<char*>("words"), const_cast<char*>("chunk"),
+                           const_cast<char*>("threads"), const_cast<char*>("filter"),
+                           NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nnO", kwlist, &words, &chunk,
+                                   &threads, &filter)) {
+    return NULL;
+  }
+  if (chunk < 1 || threads < 0) {
+    PyErr_SetString(PyExc_ValueError, "chunk must be positive, threads must not be negative");
+    return NULL;
+  }
+  if (filter_from_object(tagset_of(self), filter, &check) < 0 ||
+      !(source = PyObject_GetIter(words))) {
+    return NULL;
+  }
+  if (!(stream = PyObject_GC_New(MajkaStream, &MajkaStreamType))) {
+    Py_DECREF(source);
+    return NULL;
+  }
+
+  if (!workers) {
+    Py_BEGIN_ALLOW_THREADS
+    workers = new pool();
+    Py_END_ALLOW_THREADS
+  }
+  stream->majka = self;
+  Py_INCREF(self);
+  stream->source = source;
+  stream->filter = filter;
+  Py_XINCREF(filter);
+  stream->state = new stream_state();
+  stream->state->l = lookup_of(self, self->flags);
+  stream->state->cancelled = false;
+  lookup_hold(stream->state->l);
+  stream->queue = new std::deque<stream_chunk*>();
+  stream->chunk = chunk;
+  stream->ahead = threads ? threads : workers->size();
+  stream->current = NULL;
+  stream->part = stream->word = 0;
+  stream->error_type = stream->error_value = stream->error_traceback = NULL;
+  PyObject_GC_Track(stream);
+  return reinterpret_cast<PyObject*>(stream);
+}
+
+static PyMethodDef Majka_methods[] = {
+  {"__reduce__", (PyCFunction)Majka_reduce, METH_NOARGS,
+   "Pickle only the dictionary identity and the settings."
+  },
+  {"__setstate__", (PyCFunction)Majka_setstate, METH_O,
+   "Restore settings of an unpickled object."
+  },
+#ifdef MAJKA_FASTCALL
+  {"find", (PyCFunction)(void(*)(void))Majka_find, METH_FASTCALL | METH_KEYWORDS,
+#else
+  {"find", (PyCFunction)Majka_find, METH_VARARGS | METH_KEYWORDS,
+#endif
+   "Get results for given word."
+  },
+  {"find_many", (PyCFunction)Majka_find_many, METH_VARARGS | METH_KEYWORDS,
+   "Get results for each word of a sequence, in the same order."
+  },
+  {"afind", (PyCFunction)Majka_afind, METH_VARARGS | METH_KEYWORDS,
+   "Awaitable variant of find, traversed by a native worker pool."
+  },
+  {"afind_many", (PyCFunction)Majka_afind_many, METH_VARARGS | METH_KEYWORDS,
+   "Awaitable variant of find_many, traversed by a native worker pool."
+  },
+  {"find_fuzzy", (PyCFunction)Majka_find_fuzzy, METH_VARARGS | METH_KEYWORDS,
+   "Get results of the words within max_distance edits of given word."
+  },
+  {"complete", (PyCFunction)Majka_complete, METH_VARARGS | METH_KEYWORDS,
+   "Get results of up to limit words (or lemmas) starting with given prefix."
+  },
+  {"decompose", (PyCFunction)Majka_decompose, METH_VARARGS | METH_KEYWORDS,
+   "Get splits of a compound word with results of its first part and of the rest."
+  },
+  {"imap", (PyCFunction)Majka_imap, METH_VARARGS | METH_KEYWORDS,
+   "Iterate over results of the words of an iterable, looked up ahead in chunks."
+  },
+  {"count", (PyCFunction)Majka_count, METH_VARARGS | METH_KEYWORDS,
+   "Count lemmas, tags or tag attributes of words of an iterable or a text."
+  },
+  {"reload", (PyCFunction)Majka_reload, METH_VARARGS | METH_KEYWORDS,
+   "Swap in the dictionary of the file (by default the current one, if it changed)."
+  },
+  {"add", (PyCFunction)Majka_add, METH_VARARGS | METH_KEYWORDS,
+   "Add a result of a word to the overlay, return 1 if it was not there yet."
+  },
+  {"add_many", (PyCFunction)Majka_add_many, METH_O,
+   "Add (word, lemma[, tag]) tuples to the overlay, return how many were new."
+  },
+  {"remove", (PyCFunction)Majka_remove, METH_VARARGS | METH_KEYWORDS,
+   "Remove results of a word (of a lemma) from the overlay, return their count."
+  },
+  {"clear_overlay", (PyCFunction)Majka_clear_overlay, METH_NOARGS,
+   "Remove all words from the overlay."
+  },
+  {"save_overlay", (PyCFunction)Majka_save_overlay, METH_VARARGS,
+   "Write the overlay into a compact file."
+  },
+  {"load_overlay", (PyCFunction)Majka_load_overlay, METH_VARARGS,
+   "Replace the overlay by the one saved in a file, return its size."
+  },
+  {NULL}  /* Sentinel */
+};
+
+static PyMemberDef Majka_members[] = {
+  {const_cast<char*>("flags"), T_INT, offsetof(Majka, flags), 0,
+   const_cast<char*>("Flags to run Majka with.")},
+  {const_cast<char*>("tags"), T_BOOL, offsetof(Majka, tags), 0,
+   const_cast<char*>("If tags should be extracted and converted.")},
+  {const_cast<char*>("compact_tag"), T_BOOL, offsetof(Majka, compact_tag), 0,
+   const_cast<char*>("If original compact tag string should be extracted and returned.")},
+  {const_cast<char*>("packed_tag"), T_BOOL, offsetof(Majka, packed_tag), 0,
+   const_cast<char*>("If tag packed into a 64-bit integer should be returned.")},
+  {const_cast<char*>("first_only"), T_BOOL, offsetof(Majka, first_only), 0,
+   const_cast<char*>("If only first match should be returned.")},
+  {const_cast<char*>("best"), T_INT, offsetof(Majka, best), 0,
+   const_cast<char*>("Number of top ranked results to return, 0 for all.")},
+  {const_cast<char*>("path"), T_OBJECT, offsetof(Majka, path), READONLY,
+   const_cast<char*>("Path to the dictionary.")},
+  {const_cast<char*>("overlay_override"), T_BOOL, offsetof(Majka, overlay_override), 0,
+   const_cast<char*>("If results of overlay words should replace the ones of the dictionary.")},
+  {NULL}
+};
+
+static PyGetSetDef Majka_getset[] = {
+  {const_cast<char*>("negative"), (getter)Majka_get_negative,
+   (setter)Majka_set_negative,
+   const_cast<char*>("Negative prefix for languages supporting a negative tag."),
+   NULL},
+  {const_cast<char*>("scores"), (getter)Majka_get_scores,
+   (setter)Majka_set_scores,
+   const_cast<char*>("Weights of tag attribute-value pairs ranking results, None to rank by frequency."),
+   NULL},
+  {const_cast<char*>("tagset"), (getter)Majka_get_tagset,
+   (setter)Majka_set_tagset,
+   const_cast<char*>("File of the tagset decoding tags, None for the Czech and Slovak one."),
+   NULL},
+  {const_cast<char*>("daemon"), (getter)Majka_get_daemon, NULL,
+   const_cast<char*>("Socket of the daemon serving the lookups, None if the dictionary is loaded."), NULL},
+  {const_cast<char*>("resident"), (getter)Majka_get_resident, NULL,
+   const_cast<char*>("RESIDENT_* options which took effect for the dictionary."), NULL},
+  {const_cast<char*>("overlay_size"), (getter)Majka_get_overlay_size, NULL,
+   const_cast<char*>("Number of results in the overlay."), NULL},
+  {NULL}
+};
+
+static PyTypeObject MajkaType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "majka.Majka",             /* tp_name */
+  sizeof(Majka),             /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  (destructor)Majka_dealloc, /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_reserved */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  0,                         /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT |
+      Py_TPFLAGS_BASETYPE,   /* tp_flags */
+  "Majka object",            /* tp_doc */
+  0,                         /* tp_traverse */
+  0,                         /* tp_clear */
+  0,                         /* tp_richcompare */
+  0,                         /* tp_weaklistoffset */
+  0,                         /* tp_iter */
+  0,                         /* tp_iternext */
+  Majka_methods,             /* tp_methods */
+  Majka_members,             /* tp_members */
+  Majka_getset,              /* tp_getset */
+  0,                         /* tp_base */
+  0,                         /* tp_dict */
+  0,                         /* tp_descr_get */
+  0,                         /* tp_descr_set */
+  0,                         /* tp_dictoffset */
+  (initproc)Majka_init,      /* tp_init */
+  0,                         /* tp_alloc */
+  Majka_new,                 /* tp_new */
+};
 
-  return 0;
-}
+/* Dictionary chains
+ *
+ * A chain looks a word up in several dictionaries in a row within one call,
+ * either until the first one with results (policy "first") or in all of them
+ * (policy "merge"). Results are converted by the settings of the Majka object
+ * which found them.
+ */
 
-int is_negation(const char* tag_string){
-  if (*tag_string == 'k'){
-    tag_string += 2;
-  }
-  if (*tag_string == 'e') {
-    ++tag_string;
-    if (*tag_string == 'N') {
-      return 1;
-    }
+typedef struct {
+  PyObject_HEAD
+  Py_ssize_t count;
+  Majka** members;
+  int* flags;  // -1 for the current flags of the member
+  bool merge;
+  char* scratch;
+  size_t scratch_size;
+  bool scratch_busy;
+} Chain;
+
+static void Chain_clear_members(Chain* self) {
+  for (Py_ssize_t i = 0; i < self->count; i++) {
+    Py_DECREF(self->members[i]);
   }
-  return 0;
+  delete [] self->members;
+  delete [] self->flags;
+  delete [] self->scratch;
+  self->members = NULL;
+  self->flags = NULL;
+  self->scratch = NULL;
+  self->count = 0;
 }
 
-static int dict_set(PyObject* dict, const char* key, PyObject* obj){
-  int rv = PyDict_SetItemString(dict, key, obj);
-  Py_DECREF(obj);
-  return rv;
+static void Chain_dealloc(Chain* self) {
+  Chain_clear_members(self);
+  Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
 }
 
-static int dict_set_string(PyObject* dict, const char* key, const char* val){
-  PyObject* obj = PyUnicode_FromString(val);
-  return dict_set(dict, key, obj);
+static PyObject* Chain_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+  Chain* self = reinterpret_cast<Chain*>(type->tp_alloc(type, 0));
+  self->count = 0;
+  self->members = NULL;
+  self->flags = NULL;
+  self->merge = false;
+  self->scratch = NULL;
+  self->scratch_size = 0;
+  self->scratch_busy = false;
+  return reinterpret_cast<PyObject*>(self);
 }
 
-static int dict_set_numeric(PyObject* dict, const char* key, char* val){
-  PyObject* obj = PyLong_FromString(val, NULL, 10);
-  return dict_set(dict, key, obj);
-}
+static int Chain_init(Chain* self, PyObject* args, PyObject* kwds) {
+  PyObject* members = NULL, * seq;
+  const char* policy = "first";
+  Py_ssize_t i, n;
 
-static int list_append(PyObject* list, PyObject* obj){
-  int rv = PyList_Append(list, obj);
-  Py_DECREF(obj);
-  return rv;
-}
+  static char* kwlist[] = {const_cast<char*>("members"), const_cast<char*>("policy"), NULL};
 
-static int list_append_string(PyObject* list, const char* val){
-  PyObject* obj = PyUnicode_FromString(val);
-  return list_append(list, obj);
-}
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|s", kwlist, &members, &policy)) {
+    return -1;
+  }
+  if (strcmp(policy, "first") && strcmp(policy, "merge")) {
+    PyErr_SetString(PyExc_ValueError, "Chain policy must be 'first' or 'merge'");
+    return -1;
+  }
+  if (!(seq = PySequence_Fast(members, "Chain members must be iterable"))) {
+    return -1;
+  }
 
-static PyObject* Majka_tags(const char * tag_string) {
-  PyObject* tags = PyDict_New();
-  char category = ' ';
-  char tmp[] = {'\0', '\0'};
-  PyObject* type = PyList_New(0);
+  Chain_clear_members(self);
+  self->merge = !strcmp(policy, "merge");
+  n = PySequence_Fast_GET_SIZE(seq);
+  self->members = new Majka*[n];
+  self->flags = new int[n];
+  self->scratch_size = 0;
 
-  if (*tag_string == 'k') {
-    ++tag_string;
-    category = *tag_string;
-    switch (category) {
-      case '1':
-        dict_set_string(tags, "pos", "substantive");
-        break;
-      case '2':
-        dict_set_string(tags, "pos", "adjective");
-        break;
-      case '3':
-        dict_set_string(tags, "pos", "pronomina");
-        break;
-      case '4':
-        dict_set_string(tags, "pos", "numeral");
-        break;
-      case '5':
-        dict_set_string(tags, "pos", "verb");
-        break;
-      case '6':
-        dict_set_string(tags, "pos", "adverb");
-        break;
-      case '7':
-        dict_set_string(tags, "pos", "preposition");
-        break;
-      case '8':
-        dict_set_string(tags, "pos", "conjuction");
-        break;
-      case '9':
-        dict_set_string(tags, "pos", "particle");
-        break;
-      case '0':
-        dict_set_string(tags, "pos", "interjection");
-        break;
-      case 'I':
-        dict_set_string(tags, "pos", "punctuation");
-        break;
-    }
-    ++tag_string;
-  }
+  for (i = 0; i < n; i++) {
+    PyObject* item = PySequence_Fast_GET_ITEM(seq, i), * member = item;
+    int flags = -1;
 
-  if (*tag_string == 'e') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'A':
-        PyDict_SetItemString(tags, "negation", Py_False);
-        break;
-      case 'N':
-        PyDict_SetItemString(tags, "negation", Py_True);
-        break;
+    // a member is a Majka object or a (Majka, flags) tuple
+    if (PyTuple_Check(item) &&
+        !PyArg_ParseTuple(item, "Oi:Chain member", &member, &flags)) {
+      break;
     }
-    ++tag_string;
-  }
-
-  if (*tag_string == 'a') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'P':
-        dict_set_string(tags, "aspect", "perfect");
-        break;
-      case 'I':
-        dict_set_string(tags, "aspect", "imperfect");
-        break;
+    if (!PyObject_TypeCheck(member, &MajkaType)) {
+      PyErr_SetString(PyExc_TypeError, "Chain members must be initialized Majka objects");
+      break;
     }
-    ++tag_string;
-  }
-
-  if (*tag_string == 'm') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'F':
-        dict_set_string(tags, "mode", "infinitive");
-        break;
-      case 'I':
-        dict_set_string(tags, "mode", "present indicative");
-        break;
-      case 'R':
-        dict_set_string(tags, "mode", "imperative");
-        break;
-      case 'A':
-        dict_set_string(tags, "mode", "active participle");
-        break;
-      case 'N':
-        dict_set_string(tags, "mode", "passive participle");
-        break;
-      case 'S':
-        dict_set_string(tags, "mode", "adverbium participle, present");
-        break;
-      case 'D':
-        dict_set_string(tags, "mode", "adverbium participle, past");
-        break;
-      case 'B':
-        dict_set_string(tags, "mode", "future indicative");
-        break;
+    if (!has_dictionary(reinterpret_cast<Majka*>(member), "Chain member")) break;
+    Py_INCREF(member);
+    self->members[i] = reinterpret_cast<Majka*>(member);
+    self->flags[i] = flags;
+    self->count = i + 1;
+    if (self->members[i]->majka->max_results_size > self->scratch_size) {
+      self->scratch_size = self->members[i]->majka->max_results_size;
     }
-    ++tag_string;
   }
-
-  if (*tag_string == 'p') {
-    ++tag_string;
-    tmp[0] = *tag_string;
-    dict_set_numeric(tags, "person", tmp);
-    ++tag_string;
+  Py_DECREF(seq);
+  if (i < n) {
+    Chain_clear_members(self);
+    return -1;
   }
+  self->scratch = new char[self->scratch_size];
+  return 0;
+}
 
-  if (*tag_string == 'g') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'M':
-        dict_set_string(tags, "gender", "masculine");
-        PyDict_SetItemString(tags, "animate", Py_True);
-        break;
-      case 'I':
-        dict_set_string(tags, "gender", "masculine");
-        PyDict_SetItemString(tags, "animate", Py_False);
-        break;
-      case 'F':
-        dict_set_string(tags, "gender", "feminine");
-        break;
-      case 'N':
-        dict_set_string(tags, "gender", "neuter");
-        break;
-    }
-    ++tag_string;
-  }
+struct chain_settings {
+  std::vector<lookup> members;
+  bool merge;
+  size_t scratch_size;  // members may have been reloaded since Chain_init
+};
 
-  if (*tag_string == 'n') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'S':
-        PyDict_SetItemString(tags, "singular", Py_True);
-        break;
-      case 'P':
-        PyDict_SetItemString(tags, "plural", Py_True);
-        break;
+static void chain_settings_of(const Chain* self, chain_settings* s) {
+  s->scratch_size = 0;
+  for (Py_ssize_t i = 0; i < self->count; i++) {
+    const Majka* member = self->members[i];
+    s->members.push_back(lookup_of(member, self->flags[i] < 0 ? member->flags : self->flags[i]));
+    if (member->majka->max_results_size > s->scratch_size) {
+      s->scratch_size = member->majka->max_results_size;
     }
-    ++tag_string;
   }
+  s->merge = self->merge;
+}
 
-  if (*tag_string == 'c') {
-    ++tag_string;
-    tmp[0] = *tag_string;
-    dict_set_numeric(tags, "case", tmp);
-    ++tag_string;
-  }
+/* Appends raw results of the word from the members to out and their counts
+ * to counts; may be called without the GIL held.
+ */
+static void chain_run(const chain_settings* s, const char* word,
+                      const tag_filter* filter, char* scratch,
+                      std::vector<char>* out, std::vector<int>* counts) {
+  bool found = false;
+  int rc;
 
-  if (*tag_string == 'p') {  // Duplicate
-    ++tag_string;
-    tmp[0] = *tag_string;
-    dict_set_numeric(tags, "person", tmp);
-    ++tag_string;
+  for (size_t m = 0; m < s->members.size(); m++) {
+    if (found && !s->merge) {
+      counts->push_back(0);
+      continue;
+    }
+    rc = majka_lookup(s->members[m], word, scratch, filter, out);
+    counts->push_back(rc);
+    found = found || rc;
   }
+}
 
-  if (*tag_string == 'd') {
-    ++tag_string;
-    tmp[0] = *tag_string;
-    dict_set_numeric(tags, "degree", tmp);
-    ++tag_string;
-  }
+static PyObject* chain_results(const Chain* self, const char* results,
+                               const int* counts) {
+  PyObject* ret = PyList_New(0), * part;
+  int i;
 
-  if (*tag_string == 'x') {
-    ++tag_string;
-    switch (category) {
-      case '1':
-        switch (*tag_string) {
-          case 'P':
-            list_append_string(type, "half");
-            break;
-          case 'F':
-            list_append_string(type, "family surname");
-            break;
-        }
-        break;
-      case '3':
-        switch (*tag_string) {
-          case 'P':
-            list_append_string(type, "personal");
-            break;
-          case 'O':
-            list_append_string(type, "possessive");
-            break;
-          case 'D':
-            list_append_string(type, "demonstrative");
-            break;
-          case 'T':
-            list_append_string(type, "deliminative");
-            break;
-        }
-        break;
-      case '4':
-        switch (*tag_string) {
-          case 'C':
-            list_append_string(type, "cardinal");
-            break;
-          case 'O':
-            list_append_string(type, "ordinal");
-            break;
-          case 'R':
-            list_append_string(type, "reproductive");
-            break;
-        }
-        break;
-      case '6':
-        switch (*tag_string) {
-          case 'D':
-            list_append_string(type, "demonstrative");
-            break;
-          case 'T':
-            list_append_string(type, "delimitative");
-            break;
-        }
-        break;
-      case '8':
-        switch (*tag_string) {
-          case 'C':
-            list_append_string(type, "coordinate");
-            break;
-          case 'S':
-            list_append_string(type, "subordinate");
-            break;
-        }
-        break;
-      case 'I':
-        switch (*tag_string) {
-          case '.':
-            list_append_string(type, "stop");
-            break;
-          case ',':
-            list_append_string(type, "semi-stop");
-            break;
-          case '"':
-            list_append_string(type, "parenthesis");
-            break;
-          case '(':
-            list_append_string(type, "opening");
-            break;
-          case ')':
-            list_append_string(type, "closing");
-            break;
-          case '~':
-            list_append_string(type, "other");
-            break;
-        }
-        break;
+  for (Py_ssize_t m = 0; ret && m < self->count; m++) {
+    if (!counts[m]) continue;
+    part = Majka_results(self->members[m], results, counts[m]);
+    for (i = 0; i < counts[m]; i++) results += strlen(results) + 1;
+    // first_only and best of the member may leave fewer
+    for (i = 0; part && i < PyList_GET_SIZE(part); i++) {
+      if (PyList_Append(ret, PyList_GET_ITEM(part, i)) < 0) break;
     }
-    ++tag_string;
+    if (!part || i < PyList_GET_SIZE(part)) Py_CLEAR(ret);
+    Py_XDECREF(part);
   }
+  return ret;
+}
 
-  if (*tag_string == 'y') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'F':
-        list_append_string(type, "reflective");
-        break;
-      case 'Q':
-        list_append_string(type, "interrogative");
-        break;
-      case 'R':
-        list_append_string(type, "relative");
-        break;
-      case 'N':
-        list_append_string(type, "negative");
-        break;
-      case 'I':
-        list_append_string(type, "indeterminate");
-        break;
-    }
-    ++tag_string;
-  }
+// Keys of the filters of a chain are those of the tagset of its first member
+static const tagset* chain_tagset(const Chain* self) {
+  return self->count ? tagset_of(self->members[0]) : default_tagset;
+}
 
-  if (*tag_string == 't') {
-    ++tag_string;
-    switch (*tag_string) {
-        case 'S':
-            list_append_string(type, "status");
-            break;
-        case 'D':
-            list_append_string(type, "modal");
-            break;
-        case 'T':
-            list_append_string(type, "time");
-            break;
-        case 'A':
-            list_append_string(type, "respect");
-            break;
-        case 'C':
-            list_append_string(type, "reason");
-            break;
-        case 'L':
-            list_append_string(type, "place");
-            break;
-        case 'M':
-            list_append_string(type, "manner");
-            break;
-        case 'Q':
-            list_append_string(type, "extent");
-            break;
-    }
-    ++tag_string;
-  }
+static PyObject* Chain_find(Chain* self, PyObject* args, PyObject* kwds) {
+  PyObject* word = NULL, * filter_obj = NULL;
+  std::vector<char> results;
+  std::vector<int> counts;
+  chain_settings settings;
+  tag_filter filter;
+  Py_ssize_t len;
+  const char* str;
+  char* scratch;
+  int filtered;
 
-  if (*tag_string == 'z') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'S':
-        dict_set_string(tags, "subclass", "-s enclictic");
-        break;
-      case 'Y':
-        dict_set_string(tags, "subclass", "conditional");
-        break;
-      case 'A':
-        dict_set_string(tags, "subclass", "abbreviation");
-        break;
-    }
-    ++tag_string;
-  }
+  static char* kwlist[] = {const_cast<char*>("word"), const_cast<char*>("filter"), NULL};
 
-  if (*tag_string == 'w') {
-    ++tag_string;
-    switch (*tag_string) {
-      case 'B':
-        dict_set_string(tags, "style", "poeticism");
-        break;
-      case 'H':
-        dict_set_string(tags, "style", "conversational");
-        break;
-      case 'N':
-        dict_set_string(tags, "style", "dialectal");
-        break;
-      case 'R':
-        dict_set_string(tags, "style", "rare");
-        break;
-      case 'Z':
-        dict_set_string(tags, "style", "obsolete");
-        break;
-    }
-    ++tag_string;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &word, &filter_obj)) {
+    return NULL;
   }
-
-  if (*tag_string == '~') {
-    ++tag_string;
-    tmp[0] = *tag_string;
-    dict_set_numeric(tags, "frequency", tmp);
-    ++tag_string;
+  if (!(str = as_utf8(word, &len)) ||
+      (filtered = filter_from_object(chain_tagset(self), filter_obj, &filter)) < 0) {
+    return NULL;
   }
+  chain_settings_of(self, &settings);
 
-  if (PyList_Size(type)) {
-    dict_set(tags, "type", type);
+  if (self->scratch_busy) {
+    scratch = new char[settings.scratch_size];
   } else {
-    Py_DECREF(type);
+    if (self->scratch_size < settings.scratch_size) {
+      delete [] self->scratch;
+      self->scratch = new char[settings.scratch_size];
+      self->scratch_size = settings.scratch_size;
+    }
+    scratch = self->scratch;
+    self->scratch_busy = true;
   }
-
-  if (*tag_string) {
-    dict_set_string(tags, "other", tag_string);
+  chain_run(&settings, str, filtered ? &filter : NULL, scratch, &results, &counts);
+  if (scratch == self->scratch) {
+    self->scratch_busy = false;
+  } else {
+    delete [] scratch;
   }
 
-  return tags;
+  return chain_results(self, results.data(), counts.data());
 }
 
-static PyObject* Majka_find(Majka* self, PyObject* args, PyObject* kwds) {
-  const char* word = NULL;
-  char* results = new char[self->majka->max_results_size];
-  const char* entry, * colon, * negative;
-  char tmp_lemma[300];
-  PyObject* ret = PyList_New(0);
-  PyObject* lemma, * tags, * option;
-  int rc, i;
+static PyObject* Chain_find_many(Chain* self, PyObject* args, PyObject* kwds) {
+  PyObject* words = NULL, * filter_obj = NULL, * ret;
+  std::vector<char> results;
+  std::vector<size_t> result_at;
+  std::vector<int> counts;
+  chain_settings settings;
+  int filtered;
+  batch b;
 
-  static char* kwlist[] = {const_cast<char*>("word"), NULL};
+  static char* kwlist[] = {const_cast<char*>("words"), const_cast<char*>("filter"), NULL};
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &word)) {
-    delete [] results;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &words, &filter_obj)) {
     return NULL;
   }
-
-  rc = self->majka->find(word, results, self->flags);
-
-  if (rc == 0) {
-    delete [] results;
-    return ret;
+  if ((filtered = filter_from_object(chain_tagset(self), filter_obj, &b.filter)) < 0 ||
+      batch_fill(&b, words) < 0) {
+    return NULL;
   }
+  chain_settings_of(self, &settings);
+  for (size_t m = 0; m < settings.members.size(); m++) lookup_hold(settings.members[m]);
 
-  if (self->first_only) rc = 1;
-
-#ifdef PY3K
-  negative = PyUnicode_AsUTF8(self->negative);
-#else
-  negative = PyString_AsString(self->negative);
-#endif
-
-  for (entry = results, i=0; i < rc; i++, entry += strlen(entry) + 1) {
-    colon = strchr(entry, ':');
-    memcpy(tmp_lemma, entry, colon-entry);
-    tmp_lemma[colon-entry] = '\0';
-
-    if (self->tags) {
-      lemma = PyUnicode_FromString(tmp_lemma);
-      tags = Majka_tags(colon+1);
-      option = Py_BuildValue("{s:O,s:O}",
-                             "lemma", lemma,
-                             "tags", tags);
-      Py_DECREF(tags);
-    } else {
-      if (is_negation(colon+1)){
-        memmove(tmp_lemma+strlen(negative), tmp_lemma, strlen(tmp_lemma)+1);
-        memcpy(tmp_lemma, negative, strlen(negative));
-      }
-      lemma = PyUnicode_FromString(tmp_lemma);
-      option = Py_BuildValue("{s:O}",
-                             "lemma", lemma);
-    }
-    Py_DECREF(lemma);
+  Py_BEGIN_ALLOW_THREADS
+  std::vector<char> scratch(settings.scratch_size);
+  for (size_t w = 0; w < b.word_at.size(); w++) {
+    result_at.push_back(results.size());
+    chain_run(&settings, &b.words[b.word_at[w]], filtered ? &b.filter : NULL,
+              &scratch[0], &results, &counts);
+  }
+  Py_END_ALLOW_THREADS
+  for (size_t m = 0; m < settings.members.size(); m++) lookup_release(settings.members[m]);
 
-    if (self->compact_tag) {
-      dict_set_string(option, "compact_tag", colon+1);
+  if (!(ret = PyList_New(b.word_at.size()))) return NULL;
+  for (size_t w = 0; w < b.word_at.size(); w++) {
+    PyObject* item = chain_results(self,
+                                   results.data() + result_at[w],
+                                   counts.data() + w * self->count);
+    if (!item) {
+      Py_DECREF(ret);
+      return NULL;
     }
+    PyList_SET_ITEM(ret, w, item);
+  }
+  return ret;
+}
 
-    list_append(ret, option);
+static PyObject* Chain_get_members(Chain* self, void* closure) {
+  PyObject* ret = PyList_New(self->count);
+  for (Py_ssize_t i = 0; ret && i < self->count; i++) {
+    Py_INCREF(self->members[i]);
+    PyList_SET_ITEM(ret, i, reinterpret_cast<PyObject*>(self->members[i]));
   }
-  delete [] results;
   return ret;
 }
 
-static PyMethodDef Majka_methods[] = {
-  {"find", (PyCFunction)Majka_find, METH_VARARGS | METH_KEYWORDS,
-   "Get results for given word."
+static PyMethodDef Chain_methods[] = {
+  {"find", (PyCFunction)Chain_find, METH_VARARGS | METH_KEYWORDS,
+   "Get results for given word from the chained dictionaries."
+  },
+  {"find_many", (PyCFunction)Chain_find_many, METH_VARARGS | METH_KEYWORDS,
+   "Get results for each word of a sequence, in the same order."
   },
   {NULL}  /* Sentinel */
 };
 
-static PyMemberDef Majka_members[] = {
-  {const_cast<char*>("flags"), T_INT, offsetof(Majka, flags), 0,
-   const_cast<char*>("Flags to run Majka with.")},
-  {const_cast<char*>("tags"), T_BOOL, offsetof(Majka, tags), 0,
-   const_cast<char*>("If tags should be extracted and converted.")},
-  {const_cast<char*>("compact_tag"), T_BOOL, offsetof(Majka, compact_tag), 0,
-   const_cast<char*>("If original compact tag string should be extracted and returned.")},
-  {const_cast<char*>("first_only"), T_BOOL, offsetof(Majka, first_only), 0,
-   const_cast<char*>("If only first match should be returned.")},
-  {const_cast<char*>("negative"), T_OBJECT, offsetof(Majka, negative), 0,
-   const_cast<char*>("Negative prefix for languages supporting a negative tag.")},
+static PyMemberDef Chain_members[] = {
+  {const_cast<char*>("merge"), T_BOOL, offsetof(Chain, merge), 0,
+   const_cast<char*>("If results of all dictionaries should be merged.")},
   {NULL}
 };
 
-static PyTypeObject MajkaType = {
+static PyGetSetDef Chain_getset[] = {
+  {const_cast<char*>("members"), (getter)Chain_get_members, NULL,
+   const_cast<char*>("Majka objects of the chain, in order."), NULL},
+  {NULL}
+};
+
+static PyTypeObject ChainType = {
   PyVarObject_HEAD_INIT(NULL, 0)
-  "majka.Majka",             /* tp_name */
-  sizeof(Majka),             /* tp_basicsize */
+  "majka.Chain",             /* tp_name */
+  sizeof(Chain),             /* tp_basicsize */
   0,                         /* tp_itemsize */
-  (destructor)Majka_dealloc, /* tp_dealloc */
+  (destructor)Chain_dealloc, /* tp_dealloc */
   0,                         /* tp_print */
   0,                         /* tp_getattr */
   0,                         /* tp_setattr */
@@ -576,33 +3162,260 @@ static PyTypeObject MajkaType = {
   0,                         /* tp_as_buffer */
   Py_TPFLAGS_DEFAULT |
       Py_TPFLAGS_BASETYPE,   /* tp_flags */
-  "Majka object",            /* tp_doc */
+  "Chain of Majka objects",  /* tp_doc */
   0,                         /* tp_traverse */
   0,                         /* tp_clear */
   0,                         /* tp_richcompare */
   0,                         /* tp_weaklistoffset */
   0,                         /* tp_iter */
   0,                         /* tp_iternext */
-  Majka_methods,             /* tp_methods */
-  Majka_members,             /* tp_members */
-  0,                         /* tp_getset */
+  Chain_methods,             /* tp_methods */
+  Chain_members,             /* tp_members */
+  Chain_getset,              /* tp_getset */
   0,                         /* tp_base */
   0,                         /* tp_dict */
   0,                         /* tp_descr_get */
   0,                         /* tp_descr_set */
   0,                         /* tp_dictoffset */
-  (initproc)Majka_init,      /* tp_init */
+  (initproc)Chain_init,      /* tp_init */
   0,                         /* tp_alloc */
-  Majka_new,                 /* tp_new */
+  Chain_new,                 /* tp_new */
+};
+
+/* C API
+ *
+ * Exported as majka._C_API for other extensions, see majka_capi.h.
+ */
+
+static majka_dictionary* capi_acquire(PyObject* obj) {
+  Majka* self = reinterpret_cast<Majka*>(obj);
+  if (!PyObject_TypeCheck(obj, &MajkaType)) {
+    PyErr_SetString(PyExc_TypeError, "Initialized Majka object expected");
+    return NULL;
+  }
+  if (!has_dictionary(self, "C API")) return NULL;
+  self->dict->refs++;
+  return reinterpret_cast<majka_dictionary*>(self->dict);
+}
+
+static void capi_release(majka_dictionary* dict) {
+  dictionary_close(reinterpret_cast<dictionary*>(dict));
+}
+
+static int capi_get_flags(PyObject* obj) {
+  if (!PyObject_TypeCheck(obj, &MajkaType)) {
+    PyErr_SetString(PyExc_TypeError, "Majka object expected");
+    return -1;
+  }
+  return reinterpret_cast<Majka*>(obj)->flags;
+}
+
+static majka_fsa* capi_get_fsa(majka_dictionary* dict) {
+  return reinterpret_cast<dictionary*>(dict)->majka;
+}
+
+static size_t capi_buffer_size(majka_dictionary* dict) {
+  return reinterpret_cast<dictionary*>(dict)->majka->max_results_size;
+}
+
+static int capi_find(majka_dictionary* dict, const char* word, char* buffer,
+                     int flags) {
+  return reinterpret_cast<dictionary*>(dict)->majka->find(word, buffer, flags);
+}
+
+static const char* capi_next_result(const char* result) {
+  return result + strlen(result) + 1;
+}
+
+static const char* capi_split_result(const char* result, size_t* lemma_len) {
+  const char* colon = strchr(result, ':');
+  if (!colon) {
+    *lemma_len = strlen(result);
+    return result + *lemma_len;
+  }
+  *lemma_len = colon - result;
+  return colon + 1;
+}
+
+static Majka_CAPI capi = {
+  MAJKA_CAPI_VERSION,
+  capi_acquire,
+  capi_release,
+  capi_get_flags,
+  capi_get_fsa,
+  capi_buffer_size,
+  capi_find,
+  capi_next_result,
+  capi_split_result
+};
+
+/* Packed tags
+ *
+ * Compact tags packed into 64-bit integers (see majka/majka_tags.h), so that
+ * they can be matched by masks, e.g. in numpy arrays.
+ */
+
+static PyObject* array_module = NULL;
+
+static PyObject* majka_pack_tag(PyObject* unused, PyObject* tag) {
+  Py_ssize_t len;
+  const char* str = as_utf8(tag, &len), * other;
+  uint64_t packed;
+
+  if (!str) return NULL;
+  packed = pack_tag(str, &other);
+  if (other) return Py_BuildValue("(Ks)", packed, other);
+  return Py_BuildValue("(KO)", packed, Py_None);
+}
+
+static PyObject* majka_pack_tags(PyObject* unused, PyObject* tags) {
+  PyObject* seq = PySequence_Fast(tags, "tags must be iterable");
+  PyObject* others, * array, * rv;
+  std::vector<uint64_t> packed;
+  Py_ssize_t i, n, len;
+  const char* str, * other;
+
+  if (!seq) return NULL;
+  if (!array_module && !(array_module = PyImport_ImportModule("array"))) {
+    Py_DECREF(seq);
+    return NULL;
+  }
+  if (!(others = PyDict_New())) {
+    Py_DECREF(seq);
+    return NULL;
+  }
+
+  n = PySequence_Fast_GET_SIZE(seq);
+  packed.resize(n);
+  for (i = 0; i < n; i++) {
+    if (!(str = as_utf8(PySequence_Fast_GET_ITEM(seq, i), &len))) {
+      Py_DECREF(seq);
+      Py_DECREF(others);
+      return NULL;
+    }
+    packed[i] = pack_tag(str, &other);
+    if (other) {
+      PyObject* index = PyLong_FromSsize_t(i);
+      PyObject* rest = PyUnicode_FromString(other);
+      PyDict_SetItem(others, index, rest);
+      Py_DECREF(index);
+      Py_DECREF(rest);
+    }
+  }
+  Py_DECREF(seq);
+
+  array = PyObject_CallMethod(array_module, const_cast<char*>("array"),
+                              const_cast<char*>("s"), "Q");
+  if (!array) {
+    Py_DECREF(others);
+    return NULL;
+  }
+  rv = PyObject_CallMethod(array, const_cast<char*>("frombytes"),
+                           const_cast<char*>("N"),
+                           PyBytes_FromStringAndSize(
+                               reinterpret_cast<const char*>(packed.data()),
+                               n * sizeof(uint64_t)));
+  if (!rv) {
+    Py_DECREF(array);
+    Py_DECREF(others);
+    return NULL;
+  }
+  Py_DECREF(rv);
+  return Py_BuildValue("(NN)", array, others);
+}
+
+static PyObject* majka_unpack_tag(PyObject* unused, PyObject* packed) {
+  char tag[2 * packed_fields_count + 1];
+  unsigned long long value = PyLong_AsUnsignedLongLong(packed);
+
+  if (PyErr_Occurred()) return NULL;
+  unpack_tag(value, tag);
+  return PyUnicode_FromString(tag);
+}
+
+static PyObject* majka_tag_mask(PyObject* unused, PyObject* pattern) {
+  std::string tag;
+  const char* other;
+  uint64_t value, mask = 0;
+  Py_ssize_t len;
+
+  if (PyDict_Check(pattern)) {
+    PyObject* name, * obj;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(pattern, &pos, &name, &obj)) {
+      const char* str = PyUnicode_Check(name) ? as_utf8(name, &len) : NULL;
+      unsigned char attribute;
+      std::string codes;
+      if (!str) {
+        PyErr_SetString(PyExc_TypeError, "Tag mask keys must be strings");
+        return NULL;
+      }
+      if (!(attribute = default_tagset->attribute_of(name)) && len != 1) {
+        PyErr_Format(PyExc_ValueError, "Unknown tag mask key '%s'", str);
+        return NULL;
+      }
+      if (filter_codes(default_tagset, attribute ? name : NULL, obj, &codes) < 0) {
+        return NULL;
+      }
+      if (codes.size() != 1) {
+        PyErr_Format(PyExc_ValueError, "Tag mask key '%s' needs exactly one value", str);
+        return NULL;
+      }
+      tag.push_back(attribute ? attribute : str[0]);
+      tag.append(codes);
+    }
+  } else {
+    const char* str = as_utf8(pattern, &len);
+    if (!str) return NULL;
+    tag = str;
+  }
+
+  value = pack_tag(tag.c_str(), &other);
+  if (other) {
+    PyErr_Format(PyExc_ValueError, "Cannot pack tag pattern at '%s'", other);
+    return NULL;
+  }
+  for (int i = 0; i < packed_fields_count; i++) {
+    if ((value >> packed_shift(i)) & 15) mask |= (uint64_t) 15 << packed_shift(i);
+  }
+  return Py_BuildValue("(KK)", mask, value);
+}
+
+static PyMethodDef majka_methods[] = {
+  {"pack_tag", (PyCFunction)majka_pack_tag, METH_O,
+   "Pack a compact tag into a 64-bit integer, returns (packed, other)."
+  },
+  {"pack_tags", (PyCFunction)majka_pack_tags, METH_O,
+   "Pack compact tags into array('Q'), returns (array, {index: other})."
+  },
+  {"unpack_tag", (PyCFunction)majka_unpack_tag, METH_O,
+   "Compact tag of a packed one (without the other part)."
+  },
+  {"tag_mask", (PyCFunction)majka_tag_mask, METH_O,
+   "Mask and value matching packed tags with the given pairs, returns (mask, value)."
+  },
+  {NULL}  /* Sentinel */
 };
 
+static PyObject* packed_fields_dict(void) {
+  PyObject* fields = PyDict_New();
+  for (int i = 0; i < packed_fields_count; i++) {
+    char attribute[] = {packed_fields[i].attribute, '\0'};
+    PyObject* field = Py_BuildValue("(is)", packed_shift(i), packed_fields[i].values);
+    PyDict_SetItemString(fields, attribute, field);
+    Py_DECREF(field);
+  }
+  return fields;
+}
+
 #ifdef PY3K
 static PyModuleDef majkamodule = {
   PyModuleDef_HEAD_INIT,
   "majka",
   "Majka module.",
   -1,
-  NULL, NULL, NULL, NULL, NULL
+  majka_methods,
+  NULL, NULL, NULL, NULL
 };
 
 #define init_function PyInit_majka
@@ -615,25 +3428,70 @@ static PyModuleDef majkamodule = {
 PyMODINIT_FUNC init_function(void) {
   PyObject* m;
 
-  if (PyType_Ready(&MajkaType) < 0)
+#if PY_VERSION_HEX < 0x03070000
+  PyEval_InitThreads();  // pool workers take the GIL to post results
+#endif
+  if (PyType_Ready(&MajkaType) < 0 || PyType_Ready(&ChainType) < 0 ||
+      PyType_Ready(&MajkaStreamType) < 0)
     init_return(NULL);
 #ifdef PY3K
   m = PyModule_Create(&majkamodule);
 #else
-  m = Py_InitModule3("majka", NULL, NULL);
+  m = Py_InitModule3("majka", majka_methods, NULL);
 #endif
   if (m == NULL)
     init_return(NULL);
 
+  key_word = PyUnicode_InternFromString("word");
+  key_filter = PyUnicode_InternFromString("filter");
+  key_lemma = PyUnicode_InternFromString("lemma");
+  key_tags = PyUnicode_InternFromString("tags");
+  key_compact_tag = PyUnicode_InternFromString("compact_tag");
+  key_packed_tag = PyUnicode_InternFromString("packed_tag");
+  key_distance = PyUnicode_InternFromString("distance");
+
+  default_tagset = new tagset();
+  if (!default_tagset->compile(default_tagset_definition)) init_return(NULL);
+
   Py_INCREF(&MajkaType);
   PyModule_AddObject(m, "Majka",
                      reinterpret_cast<PyObject*>(&MajkaType));
+  Py_INCREF(&ChainType);
+  PyModule_AddObject(m, "Chain",
+                     reinterpret_cast<PyObject*>(&ChainType));
   PyModule_AddObject(m, "ADD_DIACRITICS",
                      PyLong_FromLong(ADD_DIACRITICS));
   PyModule_AddObject(m, "IGNORE_CASE",
                      PyLong_FromLong(IGNORE_CASE));
   PyModule_AddObject(m, "DISALLOW_LOWERCASE",
                      PyLong_FromLong(DISALLOW_LOWERCASE));
+  PyModule_AddObject(m, "NORMALIZE",
+                     PyLong_FromLong(NORMALIZE));
+  PyModule_AddObject(m, "OOV_FILTER",
+                     PyLong_FromLong(OOV_FILTER));
+  PyModule_AddObject(m, "RESIDENT_HUGE_PAGES",
+                     PyLong_FromLong(RESIDENT_HUGE_PAGES));
+  PyModule_AddObject(m, "RESIDENT_HUGETLB",
+                     PyLong_FromLong(RESIDENT_HUGETLB));
+  PyModule_AddObject(m, "RESIDENT_PREFAULT",
+                     PyLong_FromLong(RESIDENT_PREFAULT));
+  PyModule_AddObject(m, "RESIDENT_LOCK",
+                     PyLong_FromLong(RESIDENT_LOCK));
+  PyModule_AddObject(m, "TAG_FIELDS", packed_fields_dict());
+  PyModule_AddObject(m, "_C_API",
+                     PyCapsule_New(&capi, MAJKA_CAPI_NAME, NULL));
+  PyModule_AddObject(m, "TAG_OVERFLOW",
+                     PyLong_FromUnsignedLongLong(packed_overflow));
+
+  PyObject* atexit = PyImport_ImportModule("atexit");
+  if (atexit) {
+    PyObject* shutdown = PyCFunction_New(&majka_shutdown_def, NULL);
+    PyObject* rv = PyObject_CallMethod(atexit, const_cast<char*>("register"),
+                                       const_cast<char*>("N"), shutdown);
+    Py_XDECREF(rv);
+    Py_DECREF(atexit);
+  }
+  PyErr_Clear();
   init_return(m);
 }
 
@@ -21,9 +21,16 @@ See http://nlp.fi.muni.cz/ma/''',
       author='Petr Pulc',
       author_email='petrpulc@gmail.com',
       url='https://github.com/petrpulc/python-majka',
+      headers=['majka_capi.h'],
       ext_modules=[Extension(name='majka',
-                             sources=['majka/majka.cc', 'majkamodule.cpp'],
+                             sources=['majka/majka.cc', 'majka/majka_client.cc',
+                                      'majka/majka_overlay.cc',
+                                      'majka/majka_pool.cc',
+                                      'majka/majka_tags.cc',
+                                      'majkamodule.cpp'],
                              define_macros=[('UTF', 1)],
+                             extra_compile_args=['-pthread'],
+                             extra_link_args=['-pthread'],
                              language='c++')],
       classifiers=['Environment :: Plugins',
                    'Intended Audience :: Science/Research',
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+"""
+Check of the built-in tagset against the hand-written decoder it replaced.
+
+Usage: ./tagset_check.py path/to/majkac [tags]
+
+Random compact tags (20000 by default) are compiled by majkac into a w-lt
+dictionary, one word per tag, and the tags returned by find are compared with
+those decoded by reference(), a transcription of the former decoder. Exits
+with 1 and prints the first differences if any tag decodes differently.
+"""
+
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+import majka
+
+
+# Attributes in the order the former decoder read them, with their values
+# (None for the digit as a number)
+POS = {'1': 'substantive', '2': 'adjective', '3': 'pronomina', '4': 'numeral',
+       '5': 'verb', '6': 'adverb', '7': 'preposition', '8': 'conjuction',
+       '9': 'particle', '0': 'interjection', 'I': 'punctuation'}
+ASPECT = {'P': 'perfect', 'I': 'imperfect'}
+MODE = {'F': 'infinitive', 'I': 'present indicative', 'R': 'imperative',
+        'A': 'active participle', 'N': 'passive participle',
+        'S': 'adverbium participle, present', 'D': 'adverbium participle, past',
+        'B': 'future indicative'}
+GENDER = {'M': ('masculine', True), 'I': ('masculine', False),
+          'F': ('feminine', None), 'N': ('neuter', None)}
+TYPE_X = {'1': {'P': 'half', 'F': 'family surname'},
+          '3': {'P': 'personal', 'O': 'possessive', 'D': 'demonstrative',
+                'T': 'deliminative'},
+          '4': {'C': 'cardinal', 'O': 'ordinal', 'R': 'reproductive'},
+          '6': {'D': 'demonstrative', 'T': 'delimitative'},
+          '8': {'C': 'coordinate', 'S': 'subordinate'},
+          'I': {'.': 'stop', ',': 'semi-stop', '"': 'parenthesis',
+                '(': 'opening', ')': 'closing', '~': 'other'}}
+TYPE_Y = {'F': 'reflective', 'Q': 'interrogative', 'R': 'relative',
+          'N': 'negative', 'I': 'indeterminate'}
+TYPE_T = {'S': 'status', 'D': 'modal', 'T': 'time', 'A': 'respect',
+          'C': 'reason', 'L': 'place', 'M': 'manner', 'Q': 'extent'}
+SUBCLASS = {'S': '-s enclictic', 'Y': 'conditional', 'A': 'abbreviation'}
+STYLE = {'B': 'poeticism', 'H': 'conversational', 'N': 'dialectal',
+         'R': 'rare', 'Z': 'obsolete'}
+
+ORDER = 'keampgncpdxytzw~'
+NUMERIC = 'pcd~'
+
+
+def reference(tag):
+    """Tags of the compact tag as the former hand-written decoder built them."""
+    tags, types, category, i = {}, [], ' ', 0
+
+    def pair(attribute):
+        nonlocal i
+        if tag[i:i + 1] == attribute and i + 1 < len(tag):
+            i += 2
+            return tag[i - 1]
+        return None
+
+    value = pair('k')
+    if value is not None:
+        category = value
+        if value in POS:
+            tags['pos'] = POS[value]
+    value = pair('e')
+    if value in ('A', 'N'):
+        tags['negation'] = value == 'N'
+    value = pair('a')
+    if value in ASPECT:
+        tags['aspect'] = ASPECT[value]
+    value = pair('m')
+    if value in MODE:
+        tags['mode'] = MODE[value]
+    value = pair('p')
+    if value is not None:
+        tags['person'] = int(value)
+    value = pair('g')
+    if value in GENDER:
+        tags['gender'], animate = GENDER[value]
+        if animate is not None:
+            tags['animate'] = animate
+    value = pair('n')
+    if value == 'S':
+        tags['singular'] = True
+    elif value == 'P':
+        tags['plural'] = True
+    for attribute, key in (('c', 'case'), ('p', 'person'), ('d', 'degree')):
+        value = pair(attribute)
+        if value is not None:
+            tags[key] = int(value)
+    value = pair('x')
+    if value in TYPE_X.get(category, {}):
+        types.append(TYPE_X[category][value])
+    for attribute, names in (('y', TYPE_Y), ('t', TYPE_T)):
+        value = pair(attribute)
+        if value in names:
+            types.append(names[value])
+    value = pair('z')
+    if value in SUBCLASS:
+        tags['subclass'] = SUBCLASS[value]
+    value = pair('w')
+    if value in STYLE:
+        tags['style'] = STYLE[value]
+    value = pair('~')
+    if value is not None:
+        tags['frequency'] = int(value)
+    if types:
+        tags['type'] = types
+    if tag[i:]:
+        tags['other'] = tag[i:]
+    return tags
+
+
+def random_tag(rng):
+    """Attributes mostly in order, with known, unknown and misplaced values."""
+    letters = 'ABCDFHILMNOPQRSTXYZ0123456789.,"()~'
+    tag = ''
+    for attribute in ORDER:
+        if rng.random() < 0.5:
+            continue
+        if attribute in NUMERIC:
+            tag += attribute + rng.choice('0123456789')
+        else:
+            tag += attribute + rng.choice(letters)
+    if rng.random() < 0.1:  # a pair out of order is left to 'other'
+        tag += rng.choice('keamgnxyztw') + rng.choice('ABC')
+    return tag
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+    count = int(argv[2]) if len(argv) > 2 else 20000
+    rng = random.Random(47)
+    tags = [random_tag(rng) for _ in range(count)]
+    words = ['w%06d' % i for i in range(count)]
+
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, 'tags.w-lt')
+        lines = ''.join('%s:%s:%s\n' % (w, w, t) for w, t in zip(words, tags))
+        subprocess.run([argv[1], '-f', path, '-y', '1'], input=lines.encode(),
+                       check=True)
+        morph = majka.Majka(path)
+        found = morph.find_many(words)
+
+    differences = 0
+    for word, tag, results in zip(words, tags, found):
+        expected = reference(tag)
+        decoded = results[0]['tags'] if results else None
+        if decoded != expected:
+            differences += 1
+            if differences <= 10:
+                print('%s %s: %r != %r' % (word, tag, decoded, expected))
+    print('%d tags, %d decoded differently' % (count, differences))
+    return 1 if differences else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))